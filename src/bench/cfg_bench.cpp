@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <cli_cstore.h>
+#include <cstore/cstore.hpp>
+#include <cnode/cnode.hpp>
+#include <cnode/cnode-algorithm.hpp>
+#include <commit/commit-algorithm.hpp>
+#include <cparse/cparse.hpp>
+
+using namespace cstore;
+using namespace cnode;
+using namespace std;
+using namespace chrono;
+
+/* this program benchmarks the config backend hot paths on a synthetic
+ * template tree and config. everything is generated under a scratch dir
+ * (on tmpfs by default) so that the results are not dominated by disk
+ * I/O. usage:
+ *
+ *   cfg_bench [-t <tag fan-out>] [-d <depth>] [-m <multi width>]
+ *             [-n <iterations>] [-w <scratch dir>] [-k]
+ *
+ * the template tree has "depth" levels of tag nodes "lvlN". each tag value
+ * has a single-value node "desc", a multi-value node "addr" with "multi
+ * width" values, and the tag node of the next level. so the config has
+ * (fan-out ^ depth) tag values at the bottom level.
+ *
+ * "make bench" builds and runs this with BENCH_ARGS.
+ */
+
+static unsigned int op_fanout = 10;
+static unsigned int op_depth = 3;
+static unsigned int op_width = 4;
+static unsigned int op_iters = 5;
+static bool op_keep = false;
+static string op_dir;
+
+//// generation
+static void
+mkdir_p(const string& dir)
+{
+  string cmd = "mkdir -p '" + dir + "'";
+  if (system(cmd.c_str()) != 0) {
+    fprintf(stderr, "Failed to create [%s]\n", dir.c_str());
+    exit(1);
+  }
+}
+
+static void
+write_str(const string& file, const string& data)
+{
+  FILE *fout = fopen(file.c_str(), "w");
+  if (!fout || fwrite(data.data(), data.length(), 1, fout) != 1) {
+    fprintf(stderr, "Failed to write [%s]\n", file.c_str());
+    exit(1);
+  }
+  fclose(fout);
+}
+
+static void
+gen_tmpls(const string& dir, unsigned int lvl)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "lvl%u", lvl);
+  string tdir = dir + "/" + name;
+  mkdir_p(tdir + "/node.tag/desc");
+  mkdir_p(tdir + "/node.tag/addr");
+  write_str(tdir + "/node.def", "tag:\ntype: txt\nhelp: Level\n");
+  write_str(tdir + "/node.tag/desc/node.def",
+            "type: txt\nhelp: Description\n");
+  write_str(tdir + "/node.tag/addr/node.def",
+            "multi:\ntype: txt\nhelp: Address\n");
+  if (lvl + 1 < op_depth) {
+    gen_tmpls(tdir + "/node.tag", lvl + 1);
+  }
+}
+
+/* generate the config file (into "cfg") and the corresponding active config
+ * dir. "gen" changes the desc values so that different generations differ.
+ */
+static size_t
+gen_cfg(string& cfg, const string& adir, unsigned int lvl, unsigned int gen,
+        const string& indent)
+{
+  size_t count = 0;
+  char name[32], val[32];
+  snprintf(name, sizeof(name), "lvl%u", lvl);
+  for (unsigned int i = 0; i < op_fanout; i++) {
+    snprintf(val, sizeof(val), "v%u", i);
+    string vdir = adir + "/" + name + "/" + val;
+    string desc = "desc-" + string(val) + ((gen && (i % 2)) ? "-new" : "");
+    cfg += indent + name + " " + val + " {\n";
+    cfg += indent + "    desc " + desc + "\n";
+    string avals;
+    for (unsigned int j = 0; j < op_width; j++) {
+      char a[32];
+      snprintf(a, sizeof(a), "a%u", j);
+      cfg += indent + "    addr " + a + "\n";
+      avals += string(a) + "\n";
+    }
+    if (!adir.empty()) {
+      mkdir_p(vdir + "/desc");
+      mkdir_p(vdir + "/addr");
+      write_str(vdir + "/desc/node.val", desc + "\n");
+      write_str(vdir + "/addr/node.val", avals);
+    }
+    count += 3;
+    if (lvl + 1 < op_depth) {
+      count += gen_cfg(cfg, (adir.empty() ? adir : vdir), lvl + 1, gen,
+                       indent + "    ");
+    }
+    cfg += indent + "}\n";
+  }
+  return count;
+}
+
+//// measurement
+class Result {
+public:
+  Result(const char *n, size_t c) : name(n), count(c) {};
+  void add(double ms) { samples.push_back(ms); };
+  void print() {
+    if (samples.empty()) {
+      return;
+    }
+    sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      total += samples[i];
+    }
+    double avg = total / samples.size();
+    printf("%-28s %10.3f %10.3f %10.3f %14.0f\n", name, samples[0], avg,
+           samples[samples.size() - 1],
+           (avg > 0 ? (count * 1000.0 / avg) : 0));
+  };
+
+private:
+  const char *name;
+  size_t count;
+  vector<double> samples;
+};
+
+static double
+elapsed_ms(const time_point<high_resolution_clock>& start)
+{
+  return duration_cast<microseconds>(high_resolution_clock::now()
+                                     - start).count() / 1000.0;
+}
+
+#define BENCH(res, stmt) \
+  do { \
+    for (unsigned int __i = 0; __i < op_iters; __i++) { \
+      time_point<high_resolution_clock> __start = high_resolution_clock::now(); \
+      stmt; \
+      (res).add(elapsed_ms(__start)); \
+    } \
+    (res).print(); \
+  } while (0)
+
+static size_t
+walk_tmpls(Cstore& cs, Cpath& path)
+{
+  size_t count = 0;
+  vector<string> cnodes;
+  cs.tmplGetChildNodes(path, cnodes);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    path.push(cnodes[i]);
+    tr1::shared_ptr<Ctemplate> def(cs.parseTmpl(path, false));
+    if (def.get()) {
+      ++count;
+      if (def->isTagNode()) {
+        path.push("v");
+        count += walk_tmpls(cs, path);
+        path.pop();
+      } else if (def->isTypeless()) {
+        count += walk_tmpls(cs, path);
+      }
+    }
+    path.pop();
+  }
+  return count;
+}
+
+/* template parsing is cached per process, so each "cold" walk is done in a
+ * forked child (the parent must not have parsed any template yet). the
+ * child reports the elapsed time through a pipe.
+ */
+static void
+bench_tmpl_walk(const char *name, size_t count)
+{
+  Result res(name, count);
+  for (unsigned int i = 0; i < op_iters; i++) {
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+      return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(pfd[0]);
+      Cstore *cs = Cstore::createCstore(false);
+      Cpath path;
+      time_point<high_resolution_clock> start = high_resolution_clock::now();
+      walk_tmpls(*cs, path);
+      double ms = elapsed_ms(start);
+      _exit(write(pfd[1], &ms, sizeof(ms)) == sizeof(ms) ? 0 : 1);
+    }
+    close(pfd[1]);
+    double ms;
+    if (pid > 0 && read(pfd[0], &ms, sizeof(ms)) == sizeof(ms)) {
+      res.add(ms);
+    }
+    close(pfd[0]);
+    if (pid > 0) {
+      waitpid(pid, NULL, 0);
+    }
+  }
+  res.print();
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-t <tag fan-out>] [-d <depth>] "
+          "[-m <multi width>] [-n <iterations>] [-w <scratch dir>] [-k]\n",
+          prog);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  int c;
+  while ((c = getopt(argc, argv, "t:d:m:n:w:k")) != -1) {
+    switch (c) {
+    case 't':
+      op_fanout = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      op_depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      op_width = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      op_iters = strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      op_dir = optarg;
+      break;
+    case 'k':
+      op_keep = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (op_fanout < 1 || op_depth < 1 || op_iters < 1) {
+    usage(argv[0]);
+  }
+  if (op_dir.empty()) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/dev/shm/cfg-bench.%d", getpid());
+    op_dir = buf;
+  }
+
+  // generate everything
+  string tdir = op_dir + "/templates";
+  string adir = op_dir + "/active";
+  string cfg_file1 = op_dir + "/config1";
+  string cfg_file2 = op_dir + "/config2";
+  string db_file = op_dir + "/templates.db";
+  mkdir_p(tdir);
+  mkdir_p(adir);
+  gen_tmpls(tdir, 0);
+  string cfg1, cfg2;
+  size_t nodes = gen_cfg(cfg1, adir, 0, 0, "");
+  gen_cfg(cfg2, "", 0, 1, "");
+  write_str(cfg_file1, cfg1);
+  write_str(cfg_file2, cfg2);
+  size_t tmpls = 3 * op_depth;
+
+  setenv("VYATTA_CONFIG_TEMPLATE", tdir.c_str(), 1);
+  setenv("VYATTA_ACTIVE_CONFIGURATION_DIR", adir.c_str(), 1);
+  setenv("VYATTA_CONFIG_TEMPLATE_DB", db_file.c_str(), 1);
+
+  printf("fan-out %u, depth %u, multi width %u: %zu nodes, %u iterations\n",
+         op_fanout, op_depth, op_width, nodes, op_iters);
+  printf("%-28s %10s %10s %10s %14s\n", "operation", "min(ms)", "avg(ms)",
+         "max(ms)", "items/sec");
+
+  // templates (must be done before anything parses templates)
+  bench_tmpl_walk("tmpl_parse (node.def)", tmpls);
+  pid_t pid = fork();
+  if (pid == 0) {
+    Cstore *cs = Cstore::createCstore(false);
+    _exit(cs->compileTemplates() ? 0 : 1);
+  }
+  int status = 1;
+  if (pid > 0) {
+    waitpid(pid, &status, 0);
+  }
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    bench_tmpl_walk("tmpl_parse (compiled db)", tmpls);
+  }
+
+  Cstore *cs = Cstore::createCstore(false);
+  Cpath path;
+  walk_tmpls(*cs, path); // warm up the template cache
+
+  {
+    Result res("parse_file", nodes);
+    BENCH(res, delete cparse::parse_file(cfg_file1.c_str(), *cs));
+  }
+  {
+    Result res("CfgNode (active config)", nodes);
+    BENCH(res, CfgNode t(*cs, path, true, true));
+  }
+
+  CfgNode *t1 = cparse::parse_file(cfg_file1.c_str(), *cs);
+  CfgNode *t2 = cparse::parse_file(cfg_file2.c_str(), *cs);
+  if (!t1 || !t2) {
+    fprintf(stderr, "Failed to parse generated config\n");
+    exit(1);
+  }
+  {
+    Result res("CfgDiff", nodes);
+    BENCH(res, CfgDiff d(*t1, *t2));
+  }
+  {
+    Result res("get_cmds_diff", nodes);
+    vector<Cpath> dlist, slist, clist;
+    BENCH(res, dlist.clear(); slist.clear(); clist.clear();
+          get_cmds_diff(*t1, *t2, dlist, slist, clist));
+  }
+  {
+    // discard the output
+    fflush(stdout);
+    int sfd = dup(STDOUT_FILENO);
+    int nfd = open("/dev/null", O_WRONLY);
+    Result res("show_cfg_diff", nodes);
+    for (unsigned int i = 0; i < op_iters; i++) {
+      dup2(nfd, STDOUT_FILENO);
+      time_point<high_resolution_clock> start = high_resolution_clock::now();
+      show_cfg_diff(*t1, *t2, path);
+      fflush(stdout);
+      double ms = elapsed_ms(start);
+      dup2(sfd, STDOUT_FILENO);
+      res.add(ms);
+    }
+    close(nfd);
+    close(sfd);
+    res.print();
+  }
+  {
+    Result res("getCommitTree", nodes);
+    BENCH(res, delete commit::getCommitTree(t1, t2, path));
+  }
+  printf("(commitConfig needs a mounted config session and is not run)\n");
+
+  delete t1;
+  delete t2;
+  delete cs;
+  if (!op_keep) {
+    string cmd = "rm -rf '" + op_dir + "'";
+    if (system(cmd.c_str()) != 0) {
+      fprintf(stderr, "Failed to remove [%s]\n", op_dir.c_str());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <string>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cstore/util.hpp>
+#include <cfgd/cfgd.hpp>
+
+namespace cfgd { // begin namespace cfgd
+
+using namespace std;
+using namespace cstore;
+
+const char *C_ENV_SOCKET = "VYATTA_CFG_DAEMON_SOCKET";
+
+static const uint32_t C_REQ_MAGIC = 0x76636667; // "vcfg"
+static const uint32_t C_MAX_REQ_LEN = (1 << 20);
+static const int C_NUM_FDS = 3;
+static const int C_REQ_TIMEOUT = 5; // seconds
+
+/* a request is the header (sent together with the client's stdin, stdout,
+ * and stderr fds) followed by "len" bytes containing the NUL-terminated
+ * strings: cwd, argv[0 .. argc - 1], and env[0 .. envc - 1]. "umask" is
+ * the client's file mode creation mask.
+ *
+ * the request is read by the child serving it, which replies with its pid
+ * (0 if the request is invalid). when the child terminates, the daemon
+ * sends its wait status.
+ */
+struct ReqHdr {
+  uint32_t magic;
+  uint32_t prog;
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t umask;
+  uint32_t len;
+};
+
+static bool
+_read_all(int fd, void *buf, size_t len)
+{
+  char *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t r = read(fd, p, len);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+static bool
+_write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0) {
+    ssize_t r = write(fd, p, len);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    len -= r;
+  }
+  return true;
+}
+
+static bool
+_set_sock_addr(const char *sock_path, struct sockaddr_un& addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  strcpy(addr.sun_path, sock_path);
+  return true;
+}
+
+////// client
+static pid_t _served_pid = 0;
+
+static void
+_client_sig_handler(int sig)
+{
+  // forward to the child running the operation
+  if (_served_pid > 0) {
+    kill(_served_pid, sig);
+  }
+}
+
+bool
+runClient(ProgT prog, int argc, char **argv, int& status)
+{
+  const char *sp = getenv(C_ENV_SOCKET);
+  struct sockaddr_un addr;
+  if (!sp || !sp[0] || !_set_sock_addr(sp, addr)) {
+    return false;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+              sizeof(addr)) != 0) {
+    // daemon not running
+    close(fd);
+    return false;
+  }
+
+  string data;
+  char *cwd = getcwd(NULL, 0);
+  data.append(cwd ? cwd : "/");
+  data.push_back(0);
+  free(cwd);
+  for (int i = 0; i < argc; i++) {
+    data.append(argv[i]);
+    data.push_back(0);
+  }
+  uint32_t envc = 0;
+  for (char **e = environ; *e; e++, envc++) {
+    data.append(*e);
+    data.push_back(0);
+  }
+
+  mode_t cmask = umask(0);
+  umask(cmask);
+
+  ReqHdr hdr;
+  hdr.magic = C_REQ_MAGIC;
+  hdr.prog = prog;
+  hdr.argc = argc;
+  hdr.envc = envc;
+  hdr.umask = cmask;
+  hdr.len = data.length();
+
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  char cbuf[CMSG_SPACE(sizeof(int) * C_NUM_FDS)];
+  memset(cbuf, 0, sizeof(cbuf));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * C_NUM_FDS);
+  int fds[C_NUM_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  int32_t pid = 0;
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(hdr)
+      || !_write_all(fd, data.data(), data.length())
+      || !_read_all(fd, &pid, sizeof(pid)) || pid <= 0) {
+    // request not accepted, so the operation has not been run
+    close(fd);
+    return false;
+  }
+
+  _served_pid = pid;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = _client_sig_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGQUIT, &sa, NULL);
+
+  int32_t wstatus = 0;
+  if (!_read_all(fd, &wstatus, sizeof(wstatus))) {
+    fprintf(stderr, "Lost connection to config daemon\n");
+    status = 1;
+  } else if (WIFEXITED(wstatus)) {
+    status = WEXITSTATUS(wstatus);
+  } else {
+    status = 128 + (WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0);
+  }
+  close(fd);
+  return true;
+}
+
+////// server
+static int _sigchld_pipe[2] = { -1, -1 };
+
+static void
+_server_sig_handler(int sig)
+{
+  int e = errno;
+  char c = 0;
+  if (write(_sigchld_pipe[1], &c, 1) < 0) {
+    // pipe full. a wakeup is already pending.
+  }
+  errno = e;
+}
+
+/* receive the request header and the passed fds. returns false if the
+ * request is invalid.
+ */
+static bool
+_recv_req_hdr(int cfd, ReqHdr& hdr, int fds[C_NUM_FDS])
+{
+  struct iovec iov;
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  char cbuf[CMSG_SPACE(sizeof(int) * C_NUM_FDS)];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  ssize_t r = recvmsg(cfd, &msg, MSG_CMSG_CLOEXEC);
+  if (r <= 0) {
+    return false;
+  }
+
+  bool got_fds = false;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *p = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+    if (n == C_NUM_FDS && !got_fds) {
+      memcpy(fds, p, sizeof(int) * C_NUM_FDS);
+      got_fds = true;
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        close(p[i]);
+      }
+    }
+  }
+
+  if (r != sizeof(hdr) || !got_fds || hdr.magic != C_REQ_MAGIC
+      || hdr.prog >= PROG_LAST || hdr.len > C_MAX_REQ_LEN
+      || (msg.msg_flags & MSG_CTRUNC)) {
+    if (got_fds) {
+      for (int i = 0; i < C_NUM_FDS; i++) {
+        close(fds[i]);
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+/* read the request from "cfd" and run it in the child. does not return.
+ * the read may block (up to the receive timeout), which is why it is done
+ * here rather than in the daemon's accept loop.
+ */
+static void
+_serve_req_child(const MainFuncT prog_main[PROG_LAST], int cfd)
+{
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+
+  ReqHdr hdr;
+  int fds[C_NUM_FDS];
+  int32_t rpid = 0;
+  if (!_recv_req_hdr(cfd, hdr, fds)) {
+    // tell the client to run the operation itself
+    _write_all(cfd, &rpid, sizeof(rpid));
+    _exit(1);
+  }
+  vector<char> data(hdr.len + 1, 0);
+  if (!_read_all(cfd, &(data[0]), hdr.len)) {
+    _write_all(cfd, &rpid, sizeof(rpid));
+    _exit(1);
+  }
+  data.resize(hdr.len);
+  rpid = getpid();
+  if (!_write_all(cfd, &rpid, sizeof(rpid))) {
+    _exit(1);
+  }
+  // the daemon keeps the connection to send the exit status
+  close(cfd);
+
+  for (int i = 0; i < C_NUM_FDS; i++) {
+    if (fds[i] == i) {
+      // received fds are close-on-exec
+      fcntl(i, F_SETFD, 0);
+      continue;
+    }
+    if (dup2(fds[i], i) < 0) {
+      _exit(1);
+    }
+    if (fds[i] >= C_NUM_FDS) {
+      close(fds[i]);
+    }
+  }
+
+  // unpack the strings
+  vector<char *> strs;
+  for (size_t i = 0; i < data.size(); i += (strlen(&(data[i])) + 1)) {
+    strs.push_back(&(data[i]));
+  }
+  if (strs.size() != (1 + hdr.argc + hdr.envc) || hdr.argc == 0) {
+    fprintf(stderr, "Invalid config daemon request\n");
+    _exit(1);
+  }
+  if (chdir(strs[0]) != 0) {
+    fprintf(stderr, "Cannot change to directory [%s]\n", strs[0]);
+    _exit(1);
+  }
+  clearenv();
+  for (size_t i = 0; i < hdr.envc; i++) {
+    putenv(strs[1 + hdr.argc + i]);
+  }
+  umask(hdr.umask & 0777);
+  vector<char *> argv(strs.begin() + 1, strs.begin() + 1 + hdr.argc);
+  argv.push_back(NULL);
+
+  // the program may use getopt
+  optind = 1;
+  exit(prog_main[hdr.prog](hdr.argc, &(argv[0])));
+}
+
+static void
+_serve_req(int cfd, const MainFuncT prog_main[PROG_LAST], int lfd,
+           MapT<pid_t, int>& conns)
+{
+  // only serve clients running as the same user as the daemon
+  struct ucred cred;
+  socklen_t clen = sizeof(cred);
+  if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &clen) != 0
+      || cred.uid != geteuid()) {
+    close(cfd);
+    return;
+  }
+  struct timeval tv;
+  tv.tv_sec = C_REQ_TIMEOUT;
+  tv.tv_usec = 0;
+  setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(lfd);
+    close(_sigchld_pipe[0]);
+    close(_sigchld_pipe[1]);
+    _serve_req_child(prog_main, cfd);
+  }
+  if (pid < 0) {
+    // client sees EOF and runs the operation itself
+    close(cfd);
+    return;
+  }
+  conns[pid] = cfd;
+}
+
+static void
+_reap_children(MapT<pid_t, int>& conns)
+{
+  pid_t pid;
+  int status;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    MapT<pid_t, int>::iterator p = conns.find(pid);
+    if (p == conns.end()) {
+      continue;
+    }
+    int32_t wstatus = status;
+    if (!_write_all(p->second, &wstatus, sizeof(wstatus))) {
+      // client went away
+    }
+    close(p->second);
+    conns.erase(p);
+  }
+}
+
+int
+runServer(const char *sock_path, const MainFuncT prog_main[PROG_LAST],
+          StaleFuncT stale)
+{
+  struct sockaddr_un addr;
+  if (!_set_sock_addr(sock_path, addr)) {
+    fprintf(stderr, "Invalid socket path [%s]\n", sock_path);
+    return 1;
+  }
+  if (pipe2(_sigchld_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("pipe2");
+    return 1;
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = _server_sig_handler;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lfd < 0) {
+    perror("socket");
+    return 1;
+  }
+  unlink(sock_path);
+  mode_t omask = umask(0077);
+  int r = bind(lfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  umask(omask);
+  if (r != 0 || listen(lfd, SOMAXCONN) != 0) {
+    perror("bind");
+    close(lfd);
+    return 1;
+  }
+
+  MapT<pid_t, int> conns;
+  bool restart = false;
+  while (!restart || conns.size() > 0) {
+    struct pollfd pfds[2];
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = _sigchld_pipe[0];
+    pfds[1].events = POLLIN;
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      break;
+    }
+    if (pfds[1].revents & POLLIN) {
+      char buf[64];
+      while (read(_sigchld_pipe[0], buf, sizeof(buf)) > 0);
+      _reap_children(conns);
+    }
+    if (pfds[0].revents & POLLIN) {
+      int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+      if (cfd >= 0 && stale && stale()) {
+        // client sees EOF and runs the operation itself
+        close(cfd);
+        cfd = -1;
+        // stop accepting and wait for the requests being served
+        close(lfd);
+        unlink(sock_path);
+        lfd = -1;
+        restart = true;
+      }
+      if (cfd >= 0) {
+        _serve_req(cfd, prog_main, lfd, conns);
+      }
+    }
+  }
+  if (restart) {
+    return C_SERVER_RESTART;
+  }
+  close(lfd);
+  unlink(sock_path);
+  return 1;
+}
+
+} // end namespace cfgd
+
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CFGD_HPP_
+#define _CFGD_HPP_
+
+/* config daemon.
+ *
+ * the daemon is a long-lived process that has already loaded the library,
+ * parsed the templates, etc. when the daemon socket is specified in the
+ * environment, the CLI binaries (my_cli_bin and my_cli_shell_api) act as
+ * thin clients: they pass their arguments, environment, umask, working dir,
+ * and stdin/stdout/stderr to the daemon, which forks a child (inheriting all
+ * the warm state) to run the operation, and then relays the exit status.
+ *
+ * operations are run in a forked child rather than in the daemon itself
+ * since they report failures by exiting the process (e.g., bye()) and
+ * depend on the per-invocation environment.
+ */
+namespace cfgd { // begin namespace cfgd
+
+// programs that can be served
+enum ProgT {
+  PROG_CLI_BIN,
+  PROG_CLI_SHELL_API,
+  PROG_LAST // not a valid program
+};
+
+typedef int (*MainFuncT)(int argc, char **argv);
+// returns true if the state of the daemon is out of date
+typedef bool (*StaleFuncT)();
+
+// returned by runServer() if the daemon should be restarted
+static const int C_SERVER_RESTART = -1;
+
+// environment variable specifying the daemon socket
+extern const char *C_ENV_SOCKET;
+
+/* run the invocation "argv" of program "prog" through the daemon.
+ * returns false if the daemon is not specified or cannot be reached, in
+ * which case the caller should run the operation itself. otherwise
+ * returns true and "status" is the exit status of the operation.
+ */
+bool runClient(ProgT prog, int argc, char **argv, int& status);
+
+/* serve requests on "sock_path" until terminated. "prog_main" is indexed
+ * by ProgT. returns non-zero if the server cannot be set up.
+ *
+ * "stale" (if not NULL) is checked for each request. once it returns true,
+ * the request and any later ones are left to the clients (which then run
+ * the operations themselves), and C_SERVER_RESTART is returned after the
+ * requests being served have finished.
+ */
+int runServer(const char *sock_path, const MainFuncT prog_main[PROG_LAST],
+              StaleFuncT stale);
+
+} // end namespace cfgd
+
+#endif /* _CFGD_HPP_ */
+
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <cli_cstore.h>
+#include <cstore/cstore.hpp>
+#include <cnode/cnode.hpp>
+#include <commit/commit-algorithm.hpp>
+#include <commit/commit-trace.h>
+#include <cparse/cparse.hpp>
+
+using namespace cstore;
+using namespace cnode;
+using namespace std;
+
+/* this program runs correctness checks of the config backend on a scratch
+ * template tree and config. it is run by "make check".
+ *
+ * the unionfs backend requires the working config of a session to be under
+ * the config session prefix below, so the checks that need a session are
+ * skipped if that cannot be created, e.g., when not running as a member of
+ * the config group.
+ */
+
+static const string C_WORK_PREFIX = "/opt/vyatta/config/tmp/new_config_";
+
+static string op_dir;
+static string op_work;
+
+static bool
+mkdir_p(const string& dir)
+{
+  string cmd = "mkdir -p '" + dir + "' 2>/dev/null";
+  return (system(cmd.c_str()) == 0);
+}
+
+static void
+write_str(const string& file, const string& data)
+{
+  FILE *fout = fopen(file.c_str(), "w");
+  if (!fout || fwrite(data.data(), data.length(), 1, fout) != 1) {
+    fprintf(stderr, "Failed to write [%s]\n", file.c_str());
+    exit(1);
+  }
+  fclose(fout);
+}
+
+static void
+cleanup()
+{
+  string cmd = "rm -rf '" + op_dir + "' '" + op_work + "'";
+  if (system(cmd.c_str()) != 0) {
+    fprintf(stderr, "Failed to remove scratch dirs\n");
+  }
+}
+
+static bool
+report(const char *name, bool ok)
+{
+  printf("%-40s %s\n", name, (ok ? "ok" : "FAILED"));
+  return ok;
+}
+
+static string
+read_str(const string& file)
+{
+  string data;
+  FILE *fin = fopen(file.c_str(), "r");
+  if (fin) {
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fin)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(fin);
+  }
+  return data;
+}
+
+/* set up the scratch dirs. the templates have typeless nodes "a" and "b",
+ * each with a single-value node "x". both "a" and "b" exist (empty) in the
+ * active config.
+ */
+static void
+setup_scratch()
+{
+  string tdir = op_dir + "/templates";
+  string adir = op_dir + "/active";
+  if (!mkdir_p(tdir + "/a/x") || !mkdir_p(tdir + "/b/x")
+      || !mkdir_p(adir + "/a") || !mkdir_p(adir + "/b")
+      || !mkdir_p(op_dir + "/changes") || !mkdir_p(op_dir + "/tmp")) {
+    fprintf(stderr, "Failed to create [%s]\n", op_dir.c_str());
+    cleanup();
+    exit(1);
+  }
+  write_str(tdir + "/a/node.def", "help: A\n");
+  write_str(tdir + "/a/x/node.def", "type: txt\nhelp: X\n");
+  write_str(tdir + "/b/node.def", "help: B\n");
+  write_str(tdir + "/b/x/node.def", "type: txt\nhelp: X\n");
+
+  setenv("VYATTA_CONFIG_TEMPLATE", tdir.c_str(), 1);
+  setenv("VYATTA_CONFIG_TEMPLATE_DB", (op_dir + "/templates.db").c_str(),
+         1);
+  setenv("VYATTA_ACTIVE_CONFIGURATION_DIR", adir.c_str(), 1);
+  setenv("VYATTA_CHANGES_ONLY_DIR", (op_dir + "/changes").c_str(), 1);
+  setenv("VYATTA_CONFIG_TMP", (op_dir + "/tmp").c_str(), 1);
+}
+
+// set up the scratch session with the same working config as active
+static bool
+setup_session()
+{
+  if (!mkdir_p(op_work + "/a") || !mkdir_p(op_work + "/b")) {
+    return false;
+  }
+  setenv("VYATTA_TEMP_CONFIG_DIR", op_work.c_str(), 1);
+  return true;
+}
+
+/* a commit plan run (see commit::showCommitPlan()) goes through the commit
+ * code but must not touch the trace file of an earlier commit. tracing is
+ * set up once per process, so this is done in a forked child.
+ */
+static bool
+check_plan_trace()
+{
+  string cfg_file1 = op_dir + "/plan1";
+  string cfg_file2 = op_dir + "/plan2";
+  string tfile = op_dir + "/trace.json";
+  string data = "[\n{\"name\":\"earlier commit\"},\n";
+  write_str(cfg_file1, "a {\n    x foo\n}\n");
+  write_str(cfg_file2, "a {\n    x bar\n}\nb {\n    x bar\n}\n");
+  write_str(tfile, data);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    setenv(C_ENV_COMMIT_TRACE, tfile.c_str(), 1);
+    int nfd = open("/dev/null", O_WRONLY);
+    dup2(nfd, STDOUT_FILENO);
+    Cstore *cs = Cstore::createCstore(false);
+    CfgNode *t1 = cparse::parse_file(cfg_file1.c_str(), *cs);
+    CfgNode *t2 = cparse::parse_file(cfg_file2.c_str(), *cs);
+    vector<string> hist_files;
+    _exit((t1 && t2 && commit::showCommitPlan(*cs, *t1, *t2, hist_files))
+          ? 0 : 1);
+  }
+  int status = 1;
+  if (pid > 0) {
+    waitpid(pid, &status, 0);
+  }
+  bool ok = (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  if (!ok) {
+    printf("  plan run failed\n");
+  } else if (read_str(tfile) != data) {
+    printf("  trace file modified\n");
+    ok = false;
+  }
+  return report("showCommitPlan leaves trace alone", ok);
+}
+
+/* loading a file applies the sets as a batch with deferred "changed"
+ * marking (see Cstore::loadFile()). when the file changes two disjoint
+ * subtrees, both must be marked changed.
+ */
+static bool
+check_load_marks()
+{
+  string cfg_file = op_dir + "/config";
+  write_str(cfg_file, "a {\n    x foo\n}\nb {\n    x bar\n}\n");
+
+  Cstore *cs = Cstore::createCstore(false);
+  bool ok = cs->inSession();
+  if (ok) {
+    cs->loadFile(cfg_file.c_str());
+    const char *subtrees[] = { "a", "b" };
+    for (size_t i = 0; i < 2; i++) {
+      Cpath path;
+      path.push(subtrees[i]);
+      if (!cs->cfgPathChanged(path)) {
+        printf("  [%s] not marked changed\n", subtrees[i]);
+        ok = false;
+      }
+    }
+  }
+  delete cs;
+  return report("loadFile marks disjoint subtrees", ok);
+}
+
+int
+main()
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "cfg-check.%d", getpid());
+  op_dir = string("/tmp/") + buf;
+  op_work = C_WORK_PREFIX + buf;
+
+  setup_scratch();
+  bool ok = check_plan_trace();
+  if (setup_session()) {
+    ok = (check_load_marks() && ok);
+  } else {
+    printf("Cannot create session under [%s]. Session checks skipped.\n",
+           C_WORK_PREFIX.c_str());
+  }
+  cleanup();
+  return (ok ? 0 : 1);
+}
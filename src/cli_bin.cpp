@@ -25,6 +25,8 @@
 #include <cstore/cstore.hpp>
 #include <cnode/cnode.hpp>
 #include <commit/commit-algorithm.hpp>
+#include <commit/commit-trace.h>
+#include <cfgd/cfgd.hpp>
 
 using namespace cstore;
 
@@ -197,8 +199,12 @@ static void
 doCommit(Cstore& cstore, const Cpath& path_comps)
 {
   Cpath dummy;
+  uint64_t tstart = commit_trace_begin();
   cnode::CfgNode aroot(cstore, dummy, true, true);
+  commit_trace_end(tstart, "commit", "build active config", NULL);
+  tstart = commit_trace_begin();
   cnode::CfgNode wroot(cstore, dummy, false, true);
+  commit_trace_end(tstart, "commit", "build working config", NULL);
   if (!commit::doCommit(cstore, aroot, wroot)) {
     exit(1);
   }
@@ -221,7 +227,7 @@ OpFuncT OpFunc[] = {
 };
 
 int
-main(int argc, char **argv)
+cli_bin_main(int argc, char **argv)
 {
   int i = 0;
   while (op_bin_name[i]) {
@@ -253,3 +259,15 @@ main(int argc, char **argv)
   exit(0);
 }
 
+#ifndef CLI_DAEMON
+int
+main(int argc, char **argv)
+{
+  int status;
+  if (cfgd::runClient(cfgd::PROG_CLI_BIN, argc, argv, status)) {
+    exit(status);
+  }
+  return cli_bin_main(argc, argv);
+}
+#endif
+
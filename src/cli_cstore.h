@@ -134,10 +134,12 @@ int parse_def(vtw_def *defp, const char *path, boolean type_only);
 boolean validate_value(const vtw_def *def, char *value);
 boolean execute_list(vtw_node *cur, const vtw_def *def, const char *outbuf);
 const char *type_to_name(vtw_type_e type);
+const char *act_type_to_name(vtw_act_type act);
 int initialize_output(const char *op);
 void bye(const char *msg, ...) __attribute__((format(printf, 1, 2), noreturn));
 int redirect_output(void);
 int restore_output(void);
+void set_pure_eval_scope(boolean b);
 
 /* functions from cli_objects */
 char *get_at_string(void);
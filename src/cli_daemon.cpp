@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cli_cstore.h>
+#include <cstore/cstore.hpp>
+#include <cfgd/cfgd.hpp>
+
+using namespace cstore;
+
+/* this program is the config daemon. it contains both my_cli_bin and
+ * my_cli_shell_api (built with CLI_DAEMON so that they don't have their
+ * own main()), and serves requests from them on the socket specified on
+ * the command line. usage example:
+ *
+ *   my_cli_daemon /tmp/cfgd.sock &
+ *   export VYATTA_CFG_DAEMON_SOCKET=/tmp/cfgd.sock
+ *   /opt/vyatta/sbin/vyatta-cfg-cmd-wrapper set ...
+ *
+ * the daemon must run as the same user (and with the same capabilities)
+ * as the clients would. if it is not running, the clients simply run the
+ * operations themselves.
+ *
+ * the daemon re-executes itself when the templates are recompiled (e.g.,
+ * by the package trigger) so that requests are not served with the
+ * templates it loaded at startup.
+ */
+
+extern int cli_bin_main(int argc, char **argv);
+extern int cli_shell_api_main(int argc, char **argv);
+
+static const cfgd::MainFuncT prog_main[cfgd::PROG_LAST] = {
+  &cli_bin_main,
+  &cli_shell_api_main
+};
+
+/* parse all templates so that requests (which are served in forked
+ * children) never need to.
+ */
+static void
+load_tmpls(Cstore& cstore, Cpath& path)
+{
+  vector<string> cnodes;
+  cstore.tmplGetChildNodes(path, cnodes);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    path.push(cnodes[i]);
+    tr1::shared_ptr<Ctemplate> def(cstore.parseTmpl(path, false));
+    if (def.get()) {
+      if (def->isTagNode()) {
+        // tag values are not validated here, so any value will do
+        path.push("_");
+        load_tmpls(cstore, path);
+        path.pop();
+      } else if (def->isTypeless()) {
+        load_tmpls(cstore, path);
+      }
+    }
+    path.pop();
+  }
+}
+
+static Cstore *tmpl_cstore = NULL;
+static string tmpl_stamp;
+
+static bool
+tmpls_changed()
+{
+  string stamp;
+  tmpl_cstore->getTmplStamp(stamp);
+  return (stamp != tmpl_stamp);
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <socket>\n", argv[0]);
+    exit(1);
+  }
+
+  // make sure fds 0-2 are valid for the children
+  int fd;
+  while ((fd = open("/dev/null", O_RDWR)) >= 0 && fd <= STDERR_FILENO);
+  if (fd > STDERR_FILENO) {
+    close(fd);
+  }
+
+  // get the stamp first in case the templates change while loading
+  tmpl_cstore = Cstore::createCstore(false);
+  tmpl_cstore->getTmplStamp(tmpl_stamp);
+  Cpath path;
+  load_tmpls(*tmpl_cstore, path);
+
+  int ret = cfgd::runServer(argv[1], prog_main, tmpls_changed);
+  if (ret == cfgd::C_SERVER_RESTART) {
+    execv("/proc/self/exe", argv);
+    perror("execv");
+    ret = 1;
+  }
+  return ret;
+}
+
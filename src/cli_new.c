@@ -16,8 +16,14 @@
 #ifndef F_DUPFD_CLOEXEC
 #define F_DUPFD_CLOEXEC	0x406
 #endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open	434
+#endif
 
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <spawn.h>
 #include <dirent.h>
 #include <limits.h>
 #include <stdarg.h>
@@ -32,6 +38,7 @@
 #include "cli_val_engine.h"
 
 #include "cstore/cstore-c.h"
+#include "commit/commit-trace.h"
 
 /* Defines: */
 
@@ -47,6 +54,9 @@
 #define VAR_REF_SELF_MARKER "$VAR(@)"
 #define VAR_REF_SELF_MARKER_LEN 7
 
+/* max number of args for an action executed without the shell */
+#define ACTION_MAX_ARGS 64
+
 /* Global vars: */
 vtw_path m_path, t_path;
 void *var_ref_handle = NULL;
@@ -972,6 +982,126 @@ static int change_var_value(const char* var_reference,const char* value, int act
 
 static int system_out(char *command, const char *prepend_msg, boolean eloc);
 
+/* memoized results of "pure" backtick expressions.
+ *
+ * a template can mark a backtick expression "pure" (i.e., its output only
+ * depends on the expanded command string) by starting it with ": pure;",
+ * which is a no-op for the shell, e.g.:
+ *
+ *   syntax:expression: $VAR(@) in `: pure; /bin/ls /sys/class/net`
+ *
+ * within a scope (doCommit() or loadFile(), see set_pure_eval_scope()),
+ * such an expression is only run once for each expanded command string.
+ */
+#define PURE_EVAL_MARKER ": pure;"
+#define PURE_EVAL_MARKER_LEN 7
+#define PURE_EVAL_BUCKETS 64
+struct pure_eval_ent {
+  char *cmd;
+  char *result;
+  struct pure_eval_ent *next;
+};
+static struct pure_eval_ent *pure_eval_cache[PURE_EVAL_BUCKETS];
+static boolean pure_eval_scope = FALSE;
+
+static unsigned int
+pure_eval_hash(const char *cmd)
+{
+  unsigned int h = 5381;
+  for (; *cmd; cmd++) {
+    h = ((h << 5) + h) + (unsigned char) *cmd;
+  }
+  return (h % PURE_EVAL_BUCKETS);
+}
+
+static const char *
+get_pure_eval_result(const char *cmd)
+{
+  struct pure_eval_ent *ent = pure_eval_cache[pure_eval_hash(cmd)];
+  for (; ent; ent = ent->next) {
+    if (strcmp(ent->cmd, cmd) == 0) {
+      return ent->result;
+    }
+  }
+  return NULL;
+}
+
+static void
+add_pure_eval_result(const char *cmd, const char *result)
+{
+  unsigned int h = pure_eval_hash(cmd);
+  struct pure_eval_ent *ent = my_malloc(sizeof(*ent),
+                                        "add_pure_eval_result");
+  ent->cmd = strdup(cmd);
+  ent->result = strdup(result);
+  ent->next = pure_eval_cache[h];
+  pure_eval_cache[h] = ent;
+}
+
+/* start (TRUE) or end (FALSE) a scope in which pure expressions are
+ * memoized. the memoized results are discarded in both cases.
+ */
+void
+set_pure_eval_scope(boolean b)
+{
+  int i;
+  for (i = 0; i < PURE_EVAL_BUCKETS; i++) {
+    while (pure_eval_cache[i]) {
+      struct pure_eval_ent *ent = pure_eval_cache[i];
+      pure_eval_cache[i] = ent->next;
+      free(ent->cmd);
+      free(ent->result);
+      my_free(ent);
+    }
+  }
+  pure_eval_scope = b;
+}
+
+/* cache of compiled regexes for "pattern" checks. the patterns come from
+ * the templates, so the same ones are checked over and over (e.g., during
+ * load or commit). they are keyed by the pattern string (rather than the
+ * syntax tree node, which can be freed and reused) and kept for the life
+ * of the process.
+ */
+#define REGEX_CACHE_BUCKETS 256
+struct regex_cache_ent {
+  char *pattern;
+  regex_t reg;
+  struct regex_cache_ent *next;
+};
+static struct regex_cache_ent *regex_cache[REGEX_CACHE_BUCKETS];
+
+/* return the compiled regex for the pattern. return NULL if it cannot be
+ * compiled, in which case status is set to the regcomp() error.
+ */
+static regex_t *
+get_compiled_regex(const char *pattern, int *status)
+{
+  unsigned int h = 5381;
+  const char *c;
+  struct regex_cache_ent *ent;
+
+  for (c = pattern; *c; c++) {
+    h = ((h << 5) + h) + (unsigned char) *c;
+  }
+  h %= REGEX_CACHE_BUCKETS;
+  for (ent = regex_cache[h]; ent; ent = ent->next) {
+    if (strcmp(ent->pattern, pattern) == 0) {
+      return &(ent->reg);
+    }
+  }
+
+  ent = my_malloc(sizeof(*ent), "get_compiled_regex");
+  if ((*status = regcomp(&(ent->reg), pattern, REG_EXTENDED)) != 0) {
+    my_free(ent);
+    return NULL;
+  }
+  ent->pattern = strdup(pattern);
+  ent->next = regex_cache[h];
+  regex_cache[h] = ent;
+  return &(ent->reg);
+}
+
 /****************************************************
  check_syn:
    evaluate syntax tree;
@@ -1105,7 +1235,7 @@ static boolean check_syn_func(vtw_node *cur, const char *prepend_msg,
   case PATTERN_OP:  /* left to var, right to pattern */
     {
       valstruct left;
-      regex_t myreg;
+      regex_t *myreg;
       boolean ret;
       int ii;
 
@@ -1115,17 +1245,16 @@ static boolean check_syn_func(vtw_node *cur, const char *prepend_msg,
 	ret = FALSE;
 	goto free_and_return;
       }
-      status = regcomp(&myreg, cur->vtw_node_right->vtw_node_string,
-                       REG_EXTENDED);
-      if (status)
+      myreg = get_compiled_regex(cur->vtw_node_right->vtw_node_string,
+                                 &status);
+      if (!myreg)
 	bye("Can not compile regex |%s|, result %d\n", 
 	    cur->vtw_node_right->vtw_node_string, status);
 	/* for every value */
 	for(ii = 0; ii < left.cnt || ii == 0; ++ii) {
-	status = regexec(&myreg, left.cnt?
+	status = regexec(myreg, left.cnt?
 			 left.vals[ii]:left.val,
 			 0, 0, 0);
-	regfree(&myreg);
 	if(status) {
 	  ret = FALSE;
 	  break;
@@ -1296,29 +1425,43 @@ static int eval_va(valstruct *res, vtw_node *node)
     {
       FILE *f;
       int a_len, len, rd;
+      int pure;
+      const char *cached = NULL;
 
       status = expand_string(node->vtw_node_string);
       if (status != VTWERR_OK) {
 	return FALSE;
       }
 
-      f = popen(exe_string, "r");
-      if (!f)
-	return -1;
-#define LEN 24
-      len = 0;
-      cp = my_malloc(LEN,"");
-      a_len = LEN;
-      for(;;){
-	rd = fread(cp + len, 1, a_len - len , f);
-	len += rd;
-	if (len < a_len)
-	  break;
-	cp = my_realloc(cp, a_len+LEN, "");
-	a_len += LEN;
+      pure = (pure_eval_scope
+              && strncmp(exe_string, PURE_EVAL_MARKER,
+                         PURE_EVAL_MARKER_LEN) == 0);
+      if (pure && (cached = get_pure_eval_result(exe_string))) {
+        cp = strdup(cached);
+      } else {
+        f = popen(exe_string, "r");
+        if (!f)
+          return -1;
+        /* grow the buffer geometrically */
+#define LEN 256
+        len = 0;
+        cp = my_malloc(LEN,"");
+        a_len = LEN;
+        for(;;){
+          rd = fread(cp + len, 1, a_len - len - 1, f);
+          len += rd;
+          if (len < a_len - 1)
+            break;
+          a_len *= 2;
+          cp = my_realloc(cp, a_len, "");
+        }
+#undef LEN
+        cp[len] = 0;
+        pclose(f);
+        if (pure) {
+          add_pure_eval_result(exe_string, cp);
+        }
       }
-      cp[len] = 0;
-      pclose(f);
       memset(res, 0, sizeof (*res));
       res->val_type = TEXT_TYPE;
       res->free_me = TRUE;
@@ -1984,6 +2127,22 @@ const char *type_to_name(vtw_type_e type) {
   }
 }
 
+// this corresponds to the vtw_act_type enum
+static const char *act_names[top_act] = {
+  "delete",
+  "create",
+  "activate",
+  "update",
+  "syntax",
+  "commit",
+  "begin",
+  "end"
+};
+
+const char *act_type_to_name(vtw_act_type act) {
+  return ((act >= 0 && act < top_act) ? act_names[act] : "unknown");
+}
+
 /********************* New Dir ****************************/
 
 static int set_reference_environment(const char* var_reference,
@@ -2136,8 +2295,99 @@ restore_output(void)
   return 0;
 }
 
+/* returns whether the action command needs to be run by the shell. a
+ * "simple" command, i.e., words consisting of "plain" characters only
+ * and not starting with a shell keyword/builtin, can be executed
+ * directly.
+ */
 static int
-system_out(char *cmd, const char *prepend_msg, boolean eloc)
+action_needs_shell(const char *cmd)
+{
+  static const char *sh_words[] = {
+    "!", ".", ":", "[", "alias", "break", "case", "cd", "command",
+    "continue", "eval", "exec", "exit", "export", "false", "for", "getopts",
+    "hash", "if", "local", "read", "readonly", "return", "set", "shift",
+    "source", "test", "times", "trap", "true", "type", "ulimit", "umask",
+    "unalias", "unset", "until", "wait", "while", NULL
+  };
+  const char *c;
+  size_t len;
+  int i;
+
+  for (c = cmd; *c; c++) {
+    if (!isalnum((unsigned char) *c) && !strchr(" \t_-/.,:@+", *c)) {
+      return 1;
+    }
+  }
+  cmd += strspn(cmd, " \t");
+  len = strcspn(cmd, " \t");
+  if (len == 0) {
+    return 1;
+  }
+  for (i = 0; sh_words[i]; i++) {
+    if (strlen(sh_words[i]) == len && strncmp(cmd, sh_words[i], len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* spawn the action command with its stdout/stderr going to out_fd (and
+ * rfd closed). simple commands are executed directly, and everything else
+ * is run with "sh -c". returns the child pid or -1 if failed.
+ */
+static pid_t
+spawn_action(char *cmd, int rfd, int out_fd)
+{
+  extern char **environ;
+  posix_spawn_file_actions_t fa;
+  pid_t cpid = -1;
+  int ret = -1;
+
+  if (posix_spawn_file_actions_init(&fa) != 0) {
+    return -1;
+  }
+  if (posix_spawn_file_actions_addclose(&fa, rfd) != 0
+      || posix_spawn_file_actions_adddup2(&fa, out_fd, STDOUT_FILENO) != 0
+      || posix_spawn_file_actions_adddup2(&fa, out_fd, STDERR_FILENO) != 0
+      || posix_spawn_file_actions_addclose(&fa, out_fd) != 0) {
+    posix_spawn_file_actions_destroy(&fa);
+    return -1;
+  }
+
+  if (!action_needs_shell(cmd)) {
+    char *args[ACTION_MAX_ARGS + 1];
+    char *cbuf = strdup(cmd);
+    char *tok, *saveptr = NULL;
+    int n = 0;
+
+    if (cbuf) {
+      for (tok = strtok_r(cbuf, " \t", &saveptr);
+           tok && n < ACTION_MAX_ARGS;
+           tok = strtok_r(NULL, " \t", &saveptr)) {
+        args[n++] = tok;
+      }
+      args[n] = NULL;
+      if (!tok) {
+        /* if the command cannot be executed directly (e.g., not found),
+         * fall back to the shell so that the failure is the same.
+         */
+        ret = posix_spawnp(&cpid, args[0], &fa, NULL, args, environ);
+      }
+      free(cbuf);
+    }
+  }
+  if (ret != 0) {
+    char *eargs[] = { "sh", "-c", cmd, NULL };
+    ret = posix_spawn(&cpid, "/bin/sh", &fa, NULL, eargs, environ);
+  }
+
+  posix_spawn_file_actions_destroy(&fa);
+  return (ret == 0 ? cpid : -1);
+}
+
+static int
+system_out_run(char *cmd, const char *prepend_msg, boolean eloc)
 {
   int pfd[2];
   int ret;
@@ -2164,30 +2414,38 @@ system_out(char *cmd, const char *prepend_msg, boolean eloc)
    * could have used as-is.)
    *
    * the new process management mechanism below does not have this problem.
+   *
+   * child exit is detected through a pidfd when supported, so the command
+   * output is handled as soon as it is available and the child is reaped
+   * as soon as it exits. otherwise, fall back to checking every 100 ms.
    */
-  if ((cpid = fork())) {
+  {
     int status;
     int waited = 0;
     int prepend = 1;
+    int pidfd;
 
+    cpid = spawn_action(cmd, pfd[0], pfd[1]);
     close(pfd[1]);
 
     if (cpid == -1) {
       close(pfd[0]);
-      fprintf(stderr, "fork failed\n");
+      fprintf(stderr, "spawn failed\n");
       return -1;
     }
+    pidfd = syscall(SYS_pidfd_open, cpid, 0);
 
     while (1) {
       int sret;
-      fd_set readfds;
-      struct timeval timeout;
-      FD_ZERO(&readfds);
-      FD_SET(pfd[0], &readfds);
-      timeout.tv_sec = 0;
-      timeout.tv_usec = 100000;
-      sret = select(pfd[0] + 1, &readfds, NULL, NULL, &timeout);
-      if (sret == 1) {
+      struct pollfd pfds[2];
+      pfds[0].fd = pfd[0];
+      pfds[0].events = POLLIN;
+      pfds[0].revents = 0;
+      pfds[1].fd = pidfd;
+      pfds[1].events = POLLIN;
+      pfds[1].revents = 0;
+      sret = poll(pfds, (pidfd >= 0 ? 2 : 1), (pidfd >= 0 ? -1 : 100));
+      if (sret > 0 && pfds[0].revents) {
         /* ready for read */
         char buf[128];
         char *out = buf;
@@ -2313,10 +2571,19 @@ system_out(char *cmd, const char *prepend_msg, boolean eloc)
         if (out_stream != NULL) {
           if (fwrite(out, count, 1, out_stream) != 1) {
 	    close(pfd[0]);
+            if (pidfd >= 0) {
+              close(pidfd);
+            }
             return -1;
           }
           fflush(out_stream);
         }
+      } else if (sret > 0) {
+        /* child done (pipe drained) */
+        if (waitpid(cpid, &status, 0) == cpid) {
+          waited = 1;
+        }
+        break;
       } else if (sret == 0) {
         /* timeout */
         if (waitpid(cpid, &status, WNOHANG) == cpid) {
@@ -2324,7 +2591,7 @@ system_out(char *cmd, const char *prepend_msg, boolean eloc)
           waited = 1;
           break;
         }
-      } else {
+      } else if (errno != EINTR) {
         /* error (-1) */
         break;
       }
@@ -2333,23 +2600,27 @@ system_out(char *cmd, const char *prepend_msg, boolean eloc)
       fprintf(out_stream, "\n");
     }
     close(pfd[0]);
+    if (pidfd >= 0) {
+      close(pidfd);
+    }
     if (!waited) {
       if (waitpid(cpid, &status, 0) != cpid) {
         return -1;
       }
     }
     return (WIFEXITED(status) ? WEXITSTATUS(status) : 1);
-  } else {
-    /* child process */
-    close(pfd[0]);
-    if ((ret = dup2(pfd[1], STDOUT_FILENO) < 0)
-        || (ret = dup2(pfd[1], STDERR_FILENO)) < 0) {
-      exit(1);
-    }
-    close(pfd[1]);
-    char *eargs[] = { "sh", "-c", cmd, NULL };
-    execv("/bin/sh", eargs);
-    return -1; /* should not get here */
   }
 }
 
+/* run an action command (see system_out_run()). during commit, the command
+ * is recorded in the commit trace (if enabled).
+ */
+static int
+system_out(char *cmd, const char *prepend_msg, boolean eloc)
+{
+  uint64_t tstart = (is_in_commit() ? commit_trace_begin() : 0);
+  int ret = system_out_run(cmd, prepend_msg, eloc);
+  commit_trace_end(tstart, "process", "action process", cmd);
+  return ret;
+}
+
@@ -17,17 +17,22 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <cerrno>
 #include <vector>
 #include <string>
 #include <getopt.h>
+#include <unistd.h>
 
 #include <cli_cstore.h>
+#include <common/defs.h>
 #include <cstore/cstore.hpp>
 #include <cstore/util.hpp>
 #include <cnode/cnode.hpp>
 #include <cnode/cnode-algorithm.hpp>
 #include <commit/commit-algorithm.hpp>
 #include <cparse/cparse.hpp>
+#include <cfgd/cfgd.hpp>
 
 using namespace cstore;
 
@@ -65,6 +70,7 @@ int op_show_working_only = 0;
 int op_show_context_diff = 0;
 int op_show_commands = 0;
 int op_show_ignore_edit = 0;
+int op_show_filter = 0;
 char *op_show_cfg1 = NULL;
 char *op_show_cfg2 = NULL;
 
@@ -80,6 +86,26 @@ typedef struct {
   OpFuncT op_func;
 } OpT;
 
+/* in batch mode (see batch_main()), all operations run in this process.
+ * an operation "exits" by throwing OpExit, which is caught after the
+ * operation so that the next one can run.
+ */
+static bool batch_mode = false;
+
+struct OpExit {
+  int status;
+  OpExit(int s) : status(s) {}
+};
+
+static void
+op_exit(int status)
+{
+  if (batch_mode) {
+    throw OpExit(status);
+  }
+  exit(status);
+}
+
 /* outputs an environment string to be "eval"ed */
 static void
 getSessionEnv(Cstore& cstore, const Cpath& args)
@@ -97,7 +123,7 @@ getEditEnv(Cstore& cstore, const Cpath& args)
 {
   string env;
   if (!cstore.getEditEnv(args, env)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", env.c_str());
 }
@@ -108,7 +134,7 @@ getEditUpEnv(Cstore& cstore, const Cpath& args)
 {
   string env;
   if (!cstore.getEditUpEnv(env)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", env.c_str());
 }
@@ -119,7 +145,7 @@ getEditResetEnv(Cstore& cstore, const Cpath& args)
 {
   string env;
   if (!cstore.getEditResetEnv(env)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", env.c_str());
 }
@@ -127,7 +153,7 @@ getEditResetEnv(Cstore& cstore, const Cpath& args)
 static void
 editLevelAtRoot(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.editLevelAtRoot() ? 0 : 1);
+  op_exit(cstore.editLevelAtRoot() ? 0 : 1);
 }
 
 /* outputs an environment string to be "eval"ed */
@@ -136,7 +162,7 @@ getCompletionEnv(Cstore& cstore, const Cpath& args)
 {
   string env;
   if (!cstore.getCompletionEnv(args, env)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", env.c_str());
 }
@@ -158,7 +184,7 @@ static void
 markSessionUnsaved(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.markSessionUnsaved()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -166,7 +192,7 @@ static void
 unmarkSessionUnsaved(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.unmarkSessionUnsaved()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -174,7 +200,7 @@ static void
 sessionUnsaved(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.sessionUnsaved()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -182,7 +208,7 @@ static void
 sessionChanged(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.sessionChanged()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -190,7 +216,7 @@ static void
 teardownSession(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.teardownSession()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -198,7 +224,7 @@ static void
 setupSession(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.setupSession()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -206,7 +232,7 @@ static void
 inSession(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.inSession()) {
-    exit(1);
+    op_exit(1);
   }
 }
 
@@ -214,21 +240,21 @@ inSession(Cstore& cstore, const Cpath& args)
 static void
 exists(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.cfgPathExists(args, false) ? 0 : 1);
+  op_exit(cstore.cfgPathExists(args, false) ? 0 : 1);
 }
 
 /* same as existsOrig() in Perl API */
 static void
 existsActive(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.cfgPathExists(args, true) ? 0 : 1);
+  op_exit(cstore.cfgPathExists(args, true) ? 0 : 1);
 }
 
 /* same as isEffective() in Perl API */
 static void
 existsEffective(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.cfgPathEffective(args) ? 0 : 1);
+  op_exit(cstore.cfgPathEffective(args) ? 0 : 1);
 }
 
 /* isMulti */
@@ -238,7 +264,7 @@ isMulti(Cstore& cstore, const Cpath& args)
   MapT<string, string> tmap;
   cstore.getParsedTmpl(args, tmap, 0);
   string multi = tmap["multi"];
-  exit((multi == "1") ? 0 : 1);
+  op_exit((multi == "1") ? 0 : 1);
 }
 
 /* isTag */
@@ -248,7 +274,7 @@ isTag(Cstore& cstore, const Cpath& args)
   MapT<string, string> tmap;
   cstore.getParsedTmpl(args, tmap, 0);
   string tag = tmap["tag"];
-  exit((tag == "1") ? 0 : 1);
+  op_exit((tag == "1") ? 0 : 1);
 }
 
 /* isValue */
@@ -258,7 +284,7 @@ isValue(Cstore& cstore, const Cpath& args)
   MapT<string, string> tmap;
   cstore.getParsedTmpl(args, tmap, 0);
   string is_value = tmap["is_value"];
-  exit((is_value == "1") ? 0 : 1);
+  op_exit((is_value == "1") ? 0 : 1);
 }
 
 /* isLeaf */
@@ -278,7 +304,7 @@ isLeaf(Cstore& cstore, const Cpath& args)
     // typeless leaf node
     is_leaf_typeless = true;
   }
-  exit(((is_value != "1") && (tag != "1") && (type != "" || is_leaf_typeless)) ? 0 : 1);
+  op_exit(((is_value != "1") && (tag != "1") && (type != "" || is_leaf_typeless)) ? 0 : 1);
 }
 
 static void getNodeType(Cstore& cstore, const Cpath& args) {
@@ -305,7 +331,7 @@ static void getNodeType(Cstore& cstore, const Cpath& args) {
   } else {
     printf("leaf");
   }
-  exit(0);
+  op_exit(0);
   
 }
 
@@ -361,7 +387,7 @@ returnValue(Cstore& cstore, const Cpath& args)
 {
   string val;
   if (!cstore.cfgPathGetValue(args, val, false)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", val.c_str());
 }
@@ -372,7 +398,7 @@ returnActiveValue(Cstore& cstore, const Cpath& args)
 {
   string val;
   if (!cstore.cfgPathGetValue(args, val, true)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", val.c_str());
 }
@@ -383,7 +409,7 @@ returnEffectiveValue(Cstore& cstore, const Cpath& args)
 {
   string val;
   if (!cstore.cfgPathGetEffectiveValue(args, val)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", val.c_str());
 }
@@ -413,7 +439,7 @@ returnValues(Cstore& cstore, const Cpath& args)
 {
   vector<string> vvec;
   if (!cstore.cfgPathGetValues(args, vvec, false)) {
-    exit(1);
+    op_exit(1);
   }
   print_vec(vvec, " ", "'");
 }
@@ -428,7 +454,7 @@ returnActiveValues(Cstore& cstore, const Cpath& args)
 {
   vector<string> vvec;
   if (!cstore.cfgPathGetValues(args, vvec, true)) {
-    exit(1);
+    op_exit(1);
   }
   print_vec(vvec, " ", "'");
 }
@@ -443,7 +469,7 @@ returnEffectiveValues(Cstore& cstore, const Cpath& args)
 {
   vector<string> vvec;
   if (!cstore.cfgPathGetEffectiveValues(args, vvec)) {
-    exit(1);
+    op_exit(1);
   }
   print_vec(vvec, " ", "'");
 }
@@ -454,7 +480,7 @@ returnEffectiveValues(Cstore& cstore, const Cpath& args)
 static void
 validateTmplPath(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.validateTmplPath(args, false) ? 0 : 1);
+  op_exit(cstore.validateTmplPath(args, false) ? 0 : 1);
 }
 
 /* checks if specified path is a valid "template path", *including* the
@@ -463,7 +489,7 @@ validateTmplPath(Cstore& cstore, const Cpath& args)
 static void
 validateTmplValPath(Cstore& cstore, const Cpath& args)
 {
-  exit(cstore.validateTmplPath(args, true) ? 0 : 1);
+  op_exit(cstore.validateTmplPath(args, true) ? 0 : 1);
 }
 
 static void
@@ -472,17 +498,18 @@ showCfg(Cstore& cstore, const Cpath& args)
   Cpath nargs(args);
   bool active_only = (!cstore.inSession() || op_show_active_only);
   bool working_only = (cstore.inSession() && op_show_working_only);
-  cnode::CfgNode aroot(cstore, nargs, true, true);
 
   if (active_only) {
     // just show the active config (no diff)
+    cnode::CfgNode aroot(cstore, nargs, true, true);
     cnode::show_cfg(aroot, op_show_show_defaults, op_show_hide_secrets);
   } else {
     cnode::CfgNode wroot(cstore, nargs, false, true);
     if (working_only) {
-      // just show the working config (no diff)
+      // just show the working config (no diff). active config not needed.
       cnode::show_cfg(wroot, op_show_show_defaults, op_show_hide_secrets);
     } else {
+      cnode::CfgNode aroot(cstore, nargs, true, true);
       Cpath cur_path;
       cstore.getEditLevel(cur_path);
       cnode::show_cfg_diff(aroot, wroot, cur_path, op_show_show_defaults,
@@ -514,13 +541,19 @@ showCfg(Cstore& cstore, const Cpath& args)
  *       show output in "commands"
  *   --show-ignore-edit
  *       don't use the edit level in environment
+ *   --show-filter
+ *       use "args" as the absolute root path when the edit level is not
+ *       used (see below)
  *
  * note that when neither cfg1 nor cfg2 specifies a config file, the "args"
  * argument specifies the root path for the show output, and the "edit level"
  * in the environment is used.
  *
- * on the other hand, if either cfg1 or cfg2 specifies a config file, then
- * both "args" and "edit level" are ignored.
+ * on the other hand, if either cfg1 or cfg2 specifies a config file (or
+ * "--show-ignore-edit" is used), then "edit level" is ignored, and so is
+ * "args" unless "--show-filter" is used. with "--show-filter", "args"
+ * specifies the absolute root path. only that part of any config file is
+ * built, and other subtrees in the file are skipped while parsing.
  */
 static void
 showConfig(Cstore& cstore, const Cpath& args)
@@ -541,16 +574,52 @@ showConfig(Cstore& cstore, const Cpath& args)
 
   int res = cnode::showConfig(cfg1, cfg2, args, op_show_show_defaults,
                     op_show_hide_secrets, op_show_context_diff,
-                    op_show_commands, op_show_ignore_edit);
+                    op_show_commands, op_show_ignore_edit, op_show_filter);
   exit_code = res;
 }
 
+/* show the actions that "commit" would execute for the changes in the
+ * current session, in commit order, without executing anything. any args
+ * are commit trace files from earlier commits, which are used to estimate
+ * the time of the commit.
+ */
+static void
+showCommitPlan(Cstore& cstore, const Cpath& args)
+{
+  if (!cstore.inSession()) {
+    fprintf(stderr, "Not in a config session\n");
+    op_exit(1);
+  }
+  Cpath dummy;
+  cnode::CfgNode aroot(cstore, dummy, true, true);
+  cnode::CfgNode wroot(cstore, dummy, false, true);
+  vector<string> hist_files;
+  for (size_t i = 0; i < args.size(); i++) {
+    hist_files.push_back(args[i]);
+  }
+  if (!commit::showCommitPlan(cstore, aroot, wroot, hist_files)) {
+    op_exit(1);
+  }
+}
+
 static void
 loadFile(Cstore& cstore, const Cpath& args)
 {
   if (!cstore.loadFile(args[0])) {
     // loadFile failed
-    exit(1);
+    op_exit(1);
+  }
+}
+
+/* load config file at boot without a config session (see
+ * Cstore::bootLoadFile()). the session environment (see getSessionEnv)
+ * must be set up, but the session itself must not.
+ */
+static void
+bootLoadFile(Cstore& cstore, const Cpath& args)
+{
+  if (!cstore.bootLoadFile(args[0])) {
+    op_exit(1);
   }
 }
 
@@ -563,7 +632,7 @@ _cf_process_args(Cstore& cstore, const Cpath& args, Cpath& path)
   cnode::CfgNode *root = cparse::parse_file(args[0], cstore);
   if (!root) {
     // failed to parse config file
-    exit(1);
+    op_exit(1);
   }
   return root;
 }
@@ -588,6 +657,17 @@ getPostCommitHookDir(Cstore& cstore, const Cpath& args)
   }
 }
 
+/* compile the template tree into the template database so that later
+ * invocations do not need to parse the node.def files.
+ */
+static void
+compileTemplates(Cstore& cstore, const Cpath& args)
+{
+  if (!cstore.compileTemplates()) {
+    op_exit(1);
+  }
+}
+
 /* the following "cf" functions form the "config file" shell API, which
  * allows shell scripts to "query" the "config" represented by a config
  * file in a way similar to how they query the active/working config.
@@ -603,7 +683,7 @@ cfExists(Cstore& cstore, const Cpath& args)
 {
   Cpath path;
   cnode::CfgNode *root = _cf_process_args(cstore, args, path);
-  exit(cnode::findCfgNode(root, path) ? 0 : 1);
+  op_exit(cnode::findCfgNode(root, path) ? 0 : 1);
 }
 
 static void
@@ -613,7 +693,7 @@ cfReturnValue(Cstore& cstore, const Cpath& args)
   cnode::CfgNode *root = _cf_process_args(cstore, args, path);
   string value;
   if (!cnode::getCfgNodeValue(root, path, value)) {
-    exit(1);
+    op_exit(1);
   }
   printf("%s", value.c_str());
 }
@@ -625,7 +705,7 @@ cfReturnValues(Cstore& cstore, const Cpath& args)
   cnode::CfgNode *root = _cf_process_args(cstore, args, path);
   vector<string> values;
   if (!cnode::getCfgNodeValues(root, path, values)) {
-    exit(1);
+    op_exit(1);
   }
   print_vec(values, " ", "'");
 }
@@ -680,11 +760,15 @@ static OpT ops[] = {
 
   OP(showCfg, -1, NULL, -1, NULL, true),
   OP(showConfig, -1, NULL, -1, NULL, true),
+  OP(showCommitPlan, -1, NULL, -1, NULL, NULL),
   OP(loadFile, 1, "Must specify config file", -1, NULL, NULL),
+  OP(bootLoadFile, 1, "Must specify config file", -1, NULL, NULL),
 
   OP(getPreCommitHookDir, 0, "No argument expected", -1, NULL, NULL),
   OP(getPostCommitHookDir, 0, "No argument expected", -1, NULL, NULL),
 
+  OP(compileTemplates, 0, "No argument expected", -1, NULL, NULL),
+
   OP(cfExists, -1, NULL, 2, "Must specify config file and path", NULL),
   OP(cfReturnValue, -1, NULL, 2, "Must specify config file and path", NULL),
   OP(cfReturnValues, -1, NULL, 2, "Must specify config file and path", NULL),
@@ -711,14 +795,35 @@ struct option options[] = {
   {"show-context-diff", no_argument, &op_show_context_diff, 1},
   {"show-commands", no_argument, &op_show_commands, 1},
   {"show-ignore-edit", no_argument, &op_show_ignore_edit, 1},
+  {"show-filter", no_argument, &op_show_filter, 1},
   {"show-cfg1", required_argument, NULL, SHOW_CFG1},
   {"show-cfg2", required_argument, NULL, SHOW_CFG2},
   {NULL, 0, NULL, 0}
 };
 
-int
-main(int argc, char **argv)
+/* run the operation specified by the command line "argc"/"argv" (options,
+ * operation name, and args). return the exit status of the operation.
+ */
+static int
+run_op(int argc, char **argv)
 {
+  // options are per operation
+  op_show_active_only = 0;
+  op_show_show_defaults = 0;
+  op_show_hide_secrets = 0;
+  op_show_working_only = 0;
+  op_show_context_diff = 0;
+  op_show_commands = 0;
+  op_show_ignore_edit = 0;
+  op_show_filter = 0;
+  free(op_show_cfg1);
+  free(op_show_cfg2);
+  op_show_cfg1 = NULL;
+  op_show_cfg2 = NULL;
+  op_idx = -1;
+  // (re)initialize getopt
+  optind = 0;
+
   // handle options first
   int c = 0;
   while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
@@ -740,7 +845,7 @@ main(int argc, char **argv)
   int i = 0;
   if (nargs < 0) {
     fprintf(stderr, "Must specify operation\n");
-    exit(1);
+    return 1;
   }
   while (ops[i].op_name) {
     if (strcmp(oname, ops[i].op_name) == 0) {
@@ -751,24 +856,230 @@ main(int argc, char **argv)
   }
   if (op_idx == -1) {
     fprintf(stderr, "Invalid operation\n");
-    exit(1);
+    return 1;
   }
   if (OP_exact_args >= 0 && nargs != OP_exact_args) {
     fprintf(stderr, "%s\n", OP_exact_error);
-    exit(1);
+    return 1;
   }
   if (OP_min_args >= 0 && nargs < OP_min_args) {
     fprintf(stderr, "%s\n", OP_min_error);
-    exit(1);
+    return 1;
   }
 
   Cpath args(const_cast<const char **>(nargv), nargs);
 
   // call the op function
-  Cstore *cstore = Cstore::createCstore(OP_use_edit);
-  OP_func(*cstore, args);
-  delete cstore;
-  exit(exit_code);
+  static Cstore *batch_cstores[2] = { NULL, NULL };
+  Cstore *cstore = NULL;
+  if (batch_mode) {
+    // one cstore of each kind for the whole batch
+    Cstore *&cs = batch_cstores[OP_use_edit ? 1 : 0];
+    if (!cs) {
+      cs = Cstore::createCstore(OP_use_edit);
+    }
+    cstore = cs;
+  } else {
+    cstore = Cstore::createCstore(OP_use_edit);
+  }
+  if (getenv(ENV_ACTION_NAME)) {
+    /* invoked from a commit action. the configs don't change until all
+     * actions have been executed (see commit::doCommit()), so the
+     * "effective" observers can be memoized.
+     */
+    cstore->setEffectiveCache(true);
+  }
+  exit_code = 0;
+  try {
+    OP_func(*cstore, args);
+  } catch (const OpExit& e) {
+    exit_code = e.status;
+  }
+  if (!batch_mode) {
+    delete cstore;
+  }
+  return exit_code;
 }
 
+static bool
+_write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* split a batch request line into fields. fields are separated by
+ * whitespace, and (parts of) a field can be quoted with single or double
+ * quotes like in the shell (without escapes).
+ */
+static void
+_split_batch_line(const string& line, vector<string>& fields)
+{
+  size_t i = 0;
+  size_t len = line.length();
+  while (true) {
+    while (i < len && isspace(static_cast<unsigned char>(line[i]))) {
+      ++i;
+    }
+    if (i == len) {
+      break;
+    }
+    string f;
+    while (i < len && !isspace(static_cast<unsigned char>(line[i]))) {
+      char q = line[i];
+      if (q == '\'' || q == '"') {
+        size_t e = line.find(q, i + 1);
+        if (e == line.npos) {
+          e = len;
+        }
+        f.append(line, i + 1, e - i - 1);
+        i = (e < len ? e + 1 : len);
+      } else {
+        f += q;
+        ++i;
+      }
+    }
+    fields.push_back(f);
+  }
+}
+
+/* read the next batch request. return false if no more. */
+static bool
+_read_batch_req(bool null_delim, vector<string>& fields)
+{
+  fields.clear();
+  char *buf = NULL;
+  size_t blen = 0;
+  ssize_t n;
+  if (!null_delim) {
+    // skip empty lines
+    while (fields.empty() && (n = getline(&buf, &blen, stdin)) >= 0) {
+      _split_batch_line(string(buf, n), fields);
+    }
+  } else {
+    // terminated by an empty field
+    while ((n = getdelim(&buf, &blen, '\0', stdin)) > 0) {
+      if (buf[n - 1] == '\0') {
+        --n;
+      }
+      if (n == 0) {
+        break;
+      }
+      fields.push_back(string(buf, n));
+    }
+  }
+  free(buf);
+  return (!fields.empty());
+}
+
+/* batch mode:
+ *   cli-shell-api --batch
+ *   cli-shell-api --batch-null
+ *
+ * requests are read from stdin and run one at a time in this process, so
+ * the cstore (and its template caches) is shared by all of them instead
+ * of being set up by a new process for every request. a request is the
+ * same as the command line (options, operation, and args). with
+ * "--batch", a request is a line (see _split_batch_line() for fields).
+ * with "--batch-null", each field is terminated by NUL, and a request is
+ * terminated by an empty field.
+ *
+ * for each request, a header line "<exit status> <output length>\n" is
+ * written to stdout followed by the output of the operation. output to
+ * stderr is not captured. a fatal error ends the whole batch.
+ */
+static int
+batch_main(const char *prog, bool null_delim)
+{
+  FILE *tmp = tmpfile();
+  int out_fd = dup(STDOUT_FILENO);
+  if (!tmp || out_fd < 0) {
+    fprintf(stderr, "Failed to set up batch mode\n");
+    return 1;
+  }
+  int tmp_fd = fileno(tmp);
+  batch_mode = true;
+
+  vector<string> fields;
+  while (_read_batch_req(null_delim, fields)) {
+    vector<char *> argv;
+    argv.push_back(const_cast<char *>(prog));
+    for (size_t i = 0; i < fields.size(); i++) {
+      argv.push_back(const_cast<char *>(fields[i].c_str()));
+    }
+    argv.push_back(NULL);
+
+    // capture the output of the operation in the temp file
+    fflush(stdout);
+    if (ftruncate(tmp_fd, 0) != 0 || lseek(tmp_fd, 0, SEEK_SET) != 0
+        || dup2(tmp_fd, STDOUT_FILENO) < 0) {
+      fprintf(stderr, "Failed to capture output\n");
+      return 1;
+    }
+    int status = run_op(argv.size() - 1, &(argv[0]));
+    fflush(stdout);
+    dup2(out_fd, STDOUT_FILENO);
+
+    off_t len = lseek(tmp_fd, 0, SEEK_END);
+    char hdr[64];
+    snprintf(hdr, sizeof(hdr), "%d %lld\n", status,
+             static_cast<long long>(len < 0 ? 0 : len));
+    if (!_write_all(out_fd, hdr, strlen(hdr))) {
+      return 1;
+    }
+    char buf[8192];
+    off_t off = 0;
+    while (off < len) {
+      ssize_t n = pread(tmp_fd, buf, sizeof(buf), off);
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        // output is shorter than the header says. can't recover.
+        return 1;
+      }
+      if (!_write_all(out_fd, buf, n)) {
+        return 1;
+      }
+      off += n;
+    }
+  }
+  fclose(tmp);
+  close(out_fd);
+  return 0;
+}
+
+int
+cli_shell_api_main(int argc, char **argv)
+{
+  if (argc == 2 && strcmp(argv[1], "--batch") == 0) {
+    exit(batch_main(argv[0], false));
+  }
+  if (argc == 2 && strcmp(argv[1], "--batch-null") == 0) {
+    exit(batch_main(argv[0], true));
+  }
+  exit(run_op(argc, argv));
+}
+
+#ifndef CLI_DAEMON
+int
+main(int argc, char **argv)
+{
+  int status;
+  if (cfgd::runClient(cfgd::PROG_CLI_SHELL_API, argc, argv, status)) {
+    exit(status);
+  }
+  return cli_shell_api_main(argc, argv);
+}
+#endif
 
@@ -937,7 +937,13 @@ is_deactivated(const char *path_string, int in_active)
   int num = 0;
   boolean ret = FALSE;
   char **path_comps = cstore_path_string_to_path_comps(path_string, &num);
-  void *csh = cstore_init();
+  /* the handle only refers to the current session, so create it once
+   * instead of for every reference.
+   */
+  static void *csh = NULL;
+  if (!csh) {
+    csh = cstore_init();
+  }
 
   /* XXX this lib should operate on "logical paths" only, but currently
    * it is using physical paths. convert to logical paths (remove the
@@ -963,7 +969,6 @@ is_deactivated(const char *path_string, int in_active)
     ret = TRUE;
   }
   cstore_free_path_comps(path_comps, num);
-  cstore_free(csh);
   return ret;
 }
 
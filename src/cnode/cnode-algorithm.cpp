@@ -17,8 +17,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <tr1/memory>
 
+#include <unistd.h>
+
 #include <cstore/cstore.hpp>
 #include <cnode/cnode.hpp>
 #include <cparse/cparse.hpp>
@@ -41,6 +45,64 @@ static const string PFX_DIFF_NULL = "";
 const string cnode::ACTIVE_CFG = "@ACTIVE";
 const string cnode::WORKING_CFG = "@WORKING";
 
+////// output
+/* "show" output is collected in a large buffer that is written directly to
+ * the stdout fd whenever it fills up, so the output is streamed as the
+ * tree is walked without going through stdio for every small piece. the
+ * buffer is reused for the life of the process. _out_flush() must be called
+ * when the output is complete.
+ */
+static const size_t C_OUT_BUF_SIZE = 65536;
+static char _out_buf[C_OUT_BUF_SIZE];
+static size_t _out_len = 0;
+
+static void
+_out_flush()
+{
+  // anything already in stdio must come first
+  fflush(stdout);
+  size_t off = 0;
+  while (off < _out_len) {
+    ssize_t n = write(STDOUT_FILENO, _out_buf + off, _out_len - off);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // e.g., reader went away. nothing more can be done.
+      break;
+    }
+    off += n;
+  }
+  _out_len = 0;
+}
+
+static void
+_out_write(const char *data, size_t len)
+{
+  while (len > 0) {
+    if (_out_len == C_OUT_BUF_SIZE) {
+      _out_flush();
+    }
+    size_t n = min(len, C_OUT_BUF_SIZE - _out_len);
+    memcpy(_out_buf + _out_len, data, n);
+    _out_len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static inline void
+_out_str(const char *str)
+{
+  _out_write(str, strlen(str));
+}
+
+static inline void
+_out_str(const string& str)
+{
+  _out_write(str.data(), str.length());
+}
+
 ////// static (internal) functions
 static inline const char *
 diff_to_pfx(DiffState s)
@@ -61,15 +123,32 @@ diff_to_pfx(DiffState s)
 }
 
 static void
-_show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-           Cpath& cur_path, Cpath& last_ctx, bool show_def,
-           bool hide_secret, bool context_diff);
+_show_diff(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+           const CfgNode *cfg2, int level, Cpath& cur_path, Cpath& last_ctx,
+           bool show_def, bool hide_secret, bool context_diff);
 
 static void
-_get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
-               Cpath& cur_path, vector<Cpath>& del_list,
+_get_cmds_diff(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+               const CfgNode *cfg2, Cpath& cur_path, vector<Cpath>& del_list,
                vector<Cpath>& set_list, vector<Cpath>& com_list);
 
+/* "less" for sorting pointers to multi values. */
+struct ValuePtrLess {
+  bool operator()(const string *a, const string *b) const {
+    return (*a < *b);
+  }
+};
+
+static void
+_sort_values(const vector<string>& vals, vector<const string *>& svals)
+{
+  svals.reserve(vals.size());
+  for (size_t i = 0; i < vals.size(); i++) {
+    svals.push_back(&(vals[i]));
+  }
+  sort(svals.begin(), svals.end(), ValuePtrLess());
+}
+
 /* compare the values of a "multi" node in the two configs. the values and
  * the "diff" of each value are returned in "values" and "pfxs",
  * respectively.
@@ -84,15 +163,13 @@ cnode::cmp_multi_values(const CfgNode *cfg1, const CfgNode *cfg2,
 {
   const vector<string>& ovec = cfg1->getValues();
   const vector<string>& nvec = cfg2->getValues();
-  MapT<string, bool> nmap;
+  vector<const string *> osorted, nsorted;
+  _sort_values(ovec, osorted);
+  _sort_values(nvec, nsorted);
   bool changed = false;
-  for (size_t i = 0; i < nvec.size(); i++) {
-    nmap[nvec[i]] = true;
-  }
-  MapT<string, bool> omap;
   for (size_t i = 0; i < ovec.size(); i++) {
-    omap[ovec[i]] = true;
-    if (nmap.find(ovec[i]) == nmap.end()) {
+    if (!binary_search(nsorted.begin(), nsorted.end(), &(ovec[i]),
+                       ValuePtrLess())) {
       values.push_back(ovec[i]);
       pfxs.push_back(DIFF_DEL);
       changed = true;
@@ -101,7 +178,8 @@ cnode::cmp_multi_values(const CfgNode *cfg1, const CfgNode *cfg2,
 
   for (size_t i = 0; i < nvec.size(); i++) {
     values.push_back(nvec[i]);
-    if (omap.find(nvec[i]) == omap.end()) {
+    if (!binary_search(osorted.begin(), osorted.end(), &(nvec[i]),
+                       ValuePtrLess())) {
       pfxs.push_back(DIFF_ADD);
       changed = true;
     } else if (i < ovec.size() && nvec[i] == ovec[i]) {
@@ -115,61 +193,162 @@ cnode::cmp_multi_values(const CfgNode *cfg1, const CfgNode *cfg2,
   return changed;
 }
 
+////// class CfgDiff
+CfgDiff::CfgDiff(const CfgNode& cfg1, const CfgNode& cfg2)
+  : _sort_func(Cstore::getSortFunc())
+{
+  add_entry(const_cast<CfgNode *>(&cfg1), const_cast<CfgNode *>(&cfg2));
+}
+
+/* "less" for sorting child nodes by index key in display order. falls
+ * back to string comparison if there is no sort function.
+ */
+struct NodeKeyLess {
+  Cstore::SortFuncT sort_func;
+  NodeKeyLess(Cstore::SortFuncT f) : sort_func(f) {}
+  bool operator()(const CfgNode *a, const CfgNode *b) const {
+    return (sort_func ? sort_func(a->getIndexKey(), b->getIndexKey())
+            : (a->getIndexKey() < b->getIndexKey()));
+  }
+};
+
+/* children are matched by their index key (see TreeNode), i.e., the value
+ * for tag values and the name otherwise. the sort is stable so that the
+ * first of any duplicates is the one used, same as findChildNode().
+ */
 void
-cnode::cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
-                          vector<CfgNode *>& rcnodes1,
-                          vector<CfgNode *>& rcnodes2, bool& not_tag_node,
-                          bool& is_value, bool& is_leaf_typeless,
-                          string& name, string& value)
+CfgDiff::sort_children(const CfgNode *cfg, vector<CfgNode *>& cnodes)
 {
-  const CfgNode *cfg = (cfg1 ? cfg1 : cfg2);
-  is_value = cfg->isValue();
-  not_tag_node = (!cfg->isTag() || is_value);
-  is_leaf_typeless = cfg->isLeafTypeless();
-  bool is_tag_node = !not_tag_node;
-  name = cfg->getName();
-  if (is_value) {
-    value = cfg->getValue();
+  if (!cfg) {
+    return;
   }
+  cnodes = cfg->getChildNodes();
+  stable_sort(cnodes.begin(), cnodes.end(), NodeKeyLess(_sort_func));
+}
 
-  // handle child nodes
-  vector<CfgNode *> cnodes1, cnodes2;
-  if (cfg1) {
-    cnodes1 = cfg1->getChildNodes();
+// end of the run of nodes starting at b that are "equal" in sort order
+size_t
+CfgDiff::run_end(const vector<CfgNode *>& cnodes, size_t b) const
+{
+  NodeKeyLess less(_sort_func);
+  size_t e = b + 1;
+  while (e < cnodes.size() && !less(cnodes[b], cnodes[e])) {
+    ++e;
   }
-  if (cfg2) {
-    cnodes2 = cfg2->getChildNodes();
+  return e;
+}
+
+static bool
+_has_key(const vector<CfgNode *>& cnodes, size_t b, size_t e,
+         const string& key)
+{
+  for (size_t i = b; i < e; i++) {
+    if (cnodes[i]->getIndexKey() == key) {
+      return true;
+    }
   }
+  return false;
+}
 
-  MapT<string, bool> map;
-  MapT<string, CfgNode *> nmap1, nmap2;
-  for (size_t i = 0; i < cnodes1.size(); i++) {
-    string key = (is_tag_node
-                  ? cnodes1[i]->getValue() : cnodes1[i]->getName());
-    map[key] = true;
-    nmap1[key] = cnodes1[i];
+/* add the nodes in a run of nodes that are "equal" in sort order. normally
+ * a run has one node on each side (or one node on one side), but the sort
+ * order can consider different keys equal (e.g., version sort of "1" and
+ * "01"), and a parsed config can have duplicates, so the nodes are matched
+ * by key within the run.
+ */
+void
+CfgDiff::add_run(const vector<CfgNode *>& cn1, size_t b1, size_t e1,
+                 const vector<CfgNode *>& cn2, size_t b2, size_t e2)
+{
+  for (size_t i = b1; i < e1; i++) {
+    const string& key = cn1[i]->getIndexKey();
+    if (_has_key(cn1, b1, i, key)) {
+      continue;
+    }
+    CfgNode *c2 = NULL;
+    for (size_t j = b2; j < e2; j++) {
+      if (cn2[j]->getIndexKey() == key) {
+        c2 = cn2[j];
+        break;
+      }
+    }
+    add_entry(cn1[i], c2);
+  }
+  for (size_t j = b2; j < e2; j++) {
+    const string& key = cn2[j]->getIndexKey();
+    if (_has_key(cn2, b2, j, key) || _has_key(cn1, b1, e1, key)) {
+      continue;
+    }
+    add_entry(NULL, cn2[j]);
   }
-  for (size_t i = 0; i < cnodes2.size(); i++) {
-    string key = (is_tag_node
-                  ? cnodes2[i]->getValue() : cnodes2[i]->getName());
-    map[key] = true;
-    nmap2[key] = cnodes2[i];
+}
+
+void
+CfgDiff::add_entry(CfgNode *cfg1, CfgNode *cfg2)
+{
+  size_t idx = _script.size();
+  _script.push_back(Entry(cfg1, cfg2));
+
+  vector<CfgNode *> cn1, cn2;
+  sort_children(cfg1, cn1);
+  sort_children(cfg2, cn2);
+  NodeKeyLess less(_sort_func);
+  size_t i = 0, j = 0;
+  while (i < cn1.size() || j < cn2.size()) {
+    size_t ie = i, je = j;
+    if (j == cn2.size() || (i < cn1.size() && !less(cn2[j], cn1[i]))) {
+      // next in cfg1 comes first (or is equal to next in cfg2)
+      ie = run_end(cn1, i);
+      if (j < cn2.size() && !less(cn1[i], cn2[j])) {
+        je = run_end(cn2, j);
+      }
+    } else {
+      je = run_end(cn2, j);
+    }
+    add_run(cn1, i, ie, cn2, j, je);
+    i = ie;
+    j = je;
   }
+  _script[idx].end = _script.size();
+}
 
-  vector<string> cnodes;
-  MapT<string, bool>::iterator it = map.begin();
-  for (; it != map.end(); ++it) {
-    cnodes.push_back((*it).first);
+/* get the information about an intermediate node, tag node, or tag value.
+ * at least one of cfg1 and cfg2 must not be NULL.
+ */
+static void
+_get_other_node_info(const CfgNode *cfg1, const CfgNode *cfg2,
+                     bool& not_tag_node, bool& is_value,
+                     bool& is_leaf_typeless, string& name, string& value)
+{
+  const CfgNode *cfg = (cfg1 ? cfg1 : cfg2);
+  is_value = cfg->isValue();
+  not_tag_node = (!cfg->isTag() || is_value);
+  is_leaf_typeless = cfg->isLeafTypeless();
+  name = cfg->getName();
+  if (is_value) {
+    value = cfg->getValue();
   }
-  Cstore::sortNodes(cnodes);
+}
 
-  for (size_t i = 0; i < cnodes.size(); i++) {
-    MapT<string, CfgNode *>::iterator p1 = nmap1.find(cnodes[i]);
-    MapT<string, CfgNode *>::iterator p2 = nmap2.find(cnodes[i]);
-    bool in1 = (p1 != nmap1.end());
-    bool in2 = (p2 != nmap2.end());
-    CfgNode *c1 = (in1 ? p1->second : NULL);
-    CfgNode *c2 = (in2 ? p2->second : NULL);
+/* get the information about a non-leaf node and its matched child nodes
+ * (in display order). kept for existing users of the library. internally
+ * the trees are walked with CfgDiff instead.
+ */
+void
+cnode::cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
+                          vector<CfgNode *>& rcnodes1,
+                          vector<CfgNode *>& rcnodes2, bool& not_tag_node,
+                          bool& is_value, bool& is_leaf_typeless,
+                          string& name, string& value)
+{
+  _get_other_node_info(cfg1, cfg2, not_tag_node, is_value, is_leaf_typeless,
+                       name, value);
+
+  // a missing side is diffed as the other side and then dropped
+  CfgDiff diff((cfg1 ? *cfg1 : *cfg2), (cfg2 ? *cfg2 : *cfg1));
+  for (size_t c = diff.firstChild(0); c < diff.end(0); c = diff.end(c)) {
+    CfgNode *c1, *c2;
+    diff.getChild(c, cfg1, cfg2, c1, c2);
     rcnodes1.push_back(c1);
     rcnodes2.push_back(c2);
   }
@@ -210,7 +389,7 @@ _print_value_str(const string& name, const char *vstr, bool hide_secret)
       }
       if (name.find(sname[i], nlen - slen[i]) != name.npos) {
         // found secret
-        printf("****************");
+        _out_str("****************");
         return;
       }
     }
@@ -221,7 +400,9 @@ _print_value_str(const string& name, const char *vstr, bool hide_secret)
   if (*vstr == 0 || strcspn(vstr, "*}{;\011\012\013\014\015 ") < vlen) {
     quote = "\"";
   }
-  printf("%s%s%s", quote, vstr, quote);
+  _out_str(quote);
+  _out_write(vstr, vlen);
+  _out_str(quote);
 }
 
 static void
@@ -232,9 +413,9 @@ _diff_print_indent(const CfgNode *cfg1, const CfgNode *cfg2, int level,
    *       redesign, the output notation will be changed to "per-subtree"
    *       marking, so the output will be handled with the rest of the node.
    */
-  printf("%s", pfx_diff);
+  _out_str(pfx_diff);
   for (int i = 0; i < level; i++) {
-    printf("    ");
+    _out_write("    ", 4);
   }
 }
 
@@ -249,11 +430,12 @@ _diff_print_context(Cpath& cur_path, Cpath& last_ctx)
     return;
   }
   last_ctx = cur_path;
-  printf("[edit");
+  _out_str("[edit");
   for (size_t i = 0; i < cur_path.size(); i++) {
-    printf(" %s", cur_path[i]);
+    _out_write(" ", 1);
+    _out_str(cur_path[i]);
   }
-  printf("]\n");
+  _out_write("]\n", 2);
 }
 
 /* print the comment (if any) at the specified node, including "change
@@ -318,7 +500,9 @@ _diff_print_comment(const CfgNode *cfg1, const CfgNode *cfg2, int level,
       _diff_print_context(cur_path, last_ctx);
     }
     _diff_print_indent(cfg1, cfg2, level, pfx_diff);
-    printf("/* %s */\n", comment.c_str());
+    _out_write("/* ", 3);
+    _out_str(comment);
+    _out_write(" */\n", 4);
     return true;
   } else {
     return false;
@@ -375,9 +559,10 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
         const vector<string>& vvec = cfg->getValues();
         for (size_t i = 0; i < vvec.size(); i++) {
           _diff_print_indent(cfg1, cfg2, level, force_pfx_diff);
-          printf("%s ", cfg->getName().c_str());
+          _out_str(cfg->getName());
+          _out_write(" ", 1);
           _print_value_str(cfg->getName(), vvec[i].c_str(), hide_secret);
-          printf("\n");
+          _out_write("\n", 1);
         }
       }
     } else {
@@ -403,9 +588,10 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
             cprint = true;
           }
           _diff_print_indent(cfg1, cfg2, level, diff_to_pfx(pfxs[i]));
-          printf("%s ", cfg->getName().c_str());
+          _out_str(cfg->getName());
+          _out_write(" ", 1);
           _print_value_str(cfg->getName(), values[i].c_str(), hide_secret);
-          printf("\n");
+          _out_write("\n", 1);
         }
       }
     }
@@ -433,9 +619,10 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
           _diff_print_context(cur_path, last_ctx);
         }
         _diff_print_indent(cfg1, cfg2, level, force_pfx_diff);
-        printf("%s ", cfg->getName().c_str());
+        _out_str(cfg->getName());
+        _out_write(" ", 1);
         _print_value_str(cfg->getName(), val.c_str(), hide_secret);
-        printf("\n");
+        _out_write("\n", 1);
       }
     }
   }
@@ -444,9 +631,10 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
 }
 
 static void 
-_diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-                 Cpath& cur_path, Cpath& last_ctx, bool show_def,
-                 bool hide_secret, bool context_diff)
+_diff_show_other(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+                 const CfgNode *cfg2, int level, Cpath& cur_path,
+                 Cpath& last_ctx, bool show_def, bool hide_secret,
+                 bool context_diff)
 {
   bool orig_cdiff = context_diff;
   const char *pfx_diff = PFX_DIFF_NONE.c_str();
@@ -462,9 +650,8 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
 
   string name, value;
   bool not_tag_node, is_value, is_leaf_typeless;
-  vector<CfgNode *> rcnodes1, rcnodes2;
-  cmp_non_leaf_nodes(cfg1, cfg2, rcnodes1, rcnodes2, not_tag_node, is_value,
-                      is_leaf_typeless, name, value);
+  _get_other_node_info(cfg1, cfg2, not_tag_node, is_value, is_leaf_typeless,
+                       name, value);
 
   /* only print "this" node if it
    *   (1) is a tag value or an intermediate node,
@@ -520,10 +707,14 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
         if (strcspn(value.c_str(), "*}{;\011\012\013\014\015 ") < vlen) {
           quote = "\"";
         }
-        printf("%s %s%s%s", name.c_str(), quote, value.c_str(), quote);
+        _out_str(name);
+        _out_write(" ", 1);
+        _out_str(quote);
+        _out_str(value);
+        _out_str(quote);
       } else {
         // at intermediate node
-        printf("%s", name.c_str());
+        _out_str(name);
       }
       if (cprint && orig_cdiff && pfx_diff == PFX_DIFF_NONE.c_str()) {
         /* the condition means:
@@ -541,10 +732,10 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
          * in this case also set is_leaf_typeless to true to prevent a
          * dangling "}\n" from being printed at the end of this function.
          */
-        printf(" { ... }\n");
+        _out_str(" { ... }\n");
         is_leaf_typeless = true;
       } else {
-        printf("%s\n", (is_leaf_typeless ? "" : " {"));
+        _out_str(is_leaf_typeless ? "\n" : " {\n");
       }
     }
 
@@ -556,9 +747,12 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
     next_level = (level >= 0 ? level : 0);
   }
 
-  for (size_t i = 0; i < rcnodes1.size(); i++) {
-    _show_diff(rcnodes1[i], rcnodes2[i], next_level, cur_path, last_ctx,
-               show_def, hide_secret, context_diff);
+  CfgNode *c1, *c2;
+  for (size_t c = diff.firstChild(idx); c < diff.end(idx); c = diff.end(c)) {
+    if (diff.getChild(c, cfg1, cfg2, c1, c2)) {
+      _show_diff(diff, c, c1, c2, next_level, cur_path, last_ctx, show_def,
+                 hide_secret, context_diff);
+    }
   }
 
   // finish printing "this" node if necessary
@@ -574,16 +768,16 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
        */
       if (!is_leaf_typeless) {
         _diff_print_indent(cfg1, cfg2, level, pfx_diff);
-        printf("}\n");
+        _out_write("}\n", 2);
       }
     }
   }
 }
 
 static void
-_show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-           Cpath& cur_path, Cpath& last_ctx, bool show_def,
-           bool hide_secret, bool context_diff)
+_show_diff(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+           const CfgNode *cfg2, int level, Cpath& cur_path, Cpath& last_ctx,
+           bool show_def, bool hide_secret, bool context_diff)
 {
   // if doesn't exist, treat as NULL
   if (cfg1 && !cfg1->exists()) {
@@ -607,6 +801,7 @@ _show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
    * calling this with both NULL is invalid.
    */
   if (!cfg1 && !cfg2) {
+    _out_flush();
     fprintf(stderr, "_show_diff error (both config NULL)\n");
     exit(1);
   }
@@ -632,8 +827,8 @@ _show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
     return;
   } else {
     // intermediate node, tag node, or tag value
-    _diff_show_other(cfg1, cfg2, level, cur_path, last_ctx, show_def,
-                     hide_secret, context_diff);
+    _diff_show_other(diff, idx, cfg1, cfg2, level, cur_path, last_ctx,
+                     show_def, hide_secret, context_diff);
   }
 }
 
@@ -759,9 +954,10 @@ _get_cmds_diff_leaf(const CfgNode *cfg1, const CfgNode *cfg2,
 }
 
 static void
-_get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
-                     Cpath& cur_path, vector<Cpath>& del_list,
-                     vector<Cpath>& set_list, vector<Cpath>& com_list)
+_get_cmds_diff_other(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+                     const CfgNode *cfg2, Cpath& cur_path,
+                     vector<Cpath>& del_list, vector<Cpath>& set_list,
+                     vector<Cpath>& com_list)
 {
   vector<Cpath> *list = NULL;
   if (cfg1) {
@@ -781,10 +977,17 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
 
   string name, value;
   bool not_tag_node, is_value, is_leaf_typeless;
-  vector<CfgNode *> rcnodes1, rcnodes2;
-  cmp_non_leaf_nodes(cfg1, cfg2, rcnodes1, rcnodes2, not_tag_node, is_value,
-                      is_leaf_typeless, name, value);
-  if (rcnodes1.size() < 1 && list) {
+  _get_other_node_info(cfg1, cfg2, not_tag_node, is_value, is_leaf_typeless,
+                       name, value);
+  CfgNode *c1, *c2;
+  bool empty = true;
+  for (size_t c = diff.firstChild(idx); c < diff.end(idx); c = diff.end(c)) {
+    if (diff.getChild(c, cfg1, cfg2, c1, c2)) {
+      empty = false;
+      break;
+    }
+  }
+  if (empty && list) {
     // subtree is empty
     _add_path_to_list(*list, cur_path, &name, (is_value ? &value : NULL));
     return;
@@ -800,9 +1003,11 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
       cur_path.push(value);
     }
   }
-  for (size_t i = 0; i < rcnodes1.size(); i++) {
-    _get_cmds_diff(rcnodes1[i], rcnodes2[i], cur_path, del_list, set_list,
-                   com_list);
+  for (size_t c = diff.firstChild(idx); c < diff.end(idx); c = diff.end(c)) {
+    if (diff.getChild(c, cfg1, cfg2, c1, c2)) {
+      _get_cmds_diff(diff, c, c1, c2, cur_path, del_list, set_list,
+                     com_list);
+    }
   }
   if (add_this) {
     if (is_value) {
@@ -813,8 +1018,8 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
 }
 
 static void
-_get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
-               Cpath& cur_path, vector<Cpath>& del_list,
+_get_cmds_diff(const CfgDiff& diff, size_t idx, const CfgNode *cfg1,
+               const CfgNode *cfg2, Cpath& cur_path, vector<Cpath>& del_list,
                vector<Cpath>& set_list, vector<Cpath>& com_list)
 {
   // if doesn't exist, treat as NULL
@@ -836,7 +1041,8 @@ _get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
     return;
   } else {
     // intermediate node, tag node, or tag value
-    _get_cmds_diff_other(cfg1, cfg2, cur_path, del_list, set_list, com_list);
+    _get_cmds_diff_other(diff, idx, cfg1, cfg2, cur_path, del_list, set_list,
+                         com_list);
   }
 }
 
@@ -844,20 +1050,55 @@ static void
 _print_cmds_list(const char *op, vector<Cpath>& list)
 {
   for (size_t i = 0; i < list.size(); i++) {
-    printf("%s", op);
+    _out_str(op);
     for (size_t j = 0; j < list[i].size(); j++) {
-      printf(" '%s'", list[i][j]);
+      _out_write(" '", 2);
+      _out_str(list[i][j]);
+      _out_write("'", 1);
     }
-    printf("\n");
+    _out_write("\n", 1);
   }
 }
 
+/* return the subtree at "path" of the config file tree "root". if it
+ * doesn't exist, an empty tree (allocated in "empty" if necessary) is
+ * returned so that it shows as empty. NULL root (parse failure) is
+ * returned as is.
+ */
+static CfgNode *
+_get_file_subtree(CfgNode *root, const Cpath& path,
+                  tr1::shared_ptr<CfgNode>& empty)
+{
+  if (!root || path.size() == 0) {
+    return root;
+  }
+  CfgNode *node = findCfgNode(root, path);
+  if (!node) {
+    if (!empty.get()) {
+      Cpath pcomps;
+      empty.reset(new CfgNode(pcomps, NULL, NULL, NULL, 0, NULL));
+    }
+    node = empty.get();
+  }
+  return node;
+}
+
 ////// algorithms
 int
 cnode::show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                      Cpath& cur_path, bool show_def, bool hide_secret,
                      bool context_diff)
 {
+  CfgDiff diff(cfg1, cfg2);
+  return show_cfg_diff(diff, cur_path, show_def, hide_secret, context_diff);
+}
+
+int
+cnode::show_cfg_diff(const CfgDiff& diff, Cpath& cur_path, bool show_def,
+                     bool hide_secret, bool context_diff)
+{
+  const CfgNode& cfg1 = *diff.cfg1(0);
+  const CfgNode& cfg2 = *diff.cfg2(0);
   if (cfg1.isInvalid() || cfg2.isInvalid()) {
     printf("Specified configuration path is not valid\n");
     return VYOS_INVALID_PATH;
@@ -869,8 +1110,9 @@ cnode::show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
   }
   // use an invalid value for initial last_ctx
   Cpath last_ctx;
-  _show_diff(&cfg1, &cfg2, -1, cur_path, last_ctx, show_def, hide_secret,
-             context_diff);
+  _show_diff(diff, 0, &cfg1, &cfg2, -1, cur_path, last_ctx, show_def,
+             hide_secret, context_diff);
+  _out_flush();
   return VYOS_SUCCESS;
 }
 
@@ -885,15 +1127,15 @@ cnode::show_cfg(const CfgNode& cfg, bool show_def, bool hide_secret)
 void
 cnode::show_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2)
 {
-  Cpath cur_path;
   vector<Cpath> del_list;
   vector<Cpath> set_list;
   vector<Cpath> com_list;
-  _get_cmds_diff(&cfg1, &cfg2, cur_path, del_list, set_list, com_list);
+  get_cmds_diff(cfg1, cfg2, del_list, set_list, com_list);
 
   _print_cmds_list("delete", del_list);
   _print_cmds_list("set", set_list);
   _print_cmds_list("comment", com_list);
+  _out_flush();
 }
 
 void
@@ -906,18 +1148,26 @@ void
 cnode::get_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                      vector<Cpath>& del_list, vector<Cpath>& set_list,
                      vector<Cpath>& com_list)
+{
+  CfgDiff diff(cfg1, cfg2);
+  get_cmds_diff(diff, del_list, set_list, com_list);
+}
+
+void
+cnode::get_cmds_diff(const CfgDiff& diff, vector<Cpath>& del_list,
+                     vector<Cpath>& set_list, vector<Cpath>& com_list)
 {
   Cpath cur_path;
-  _get_cmds_diff(&cfg1, &cfg2, cur_path, del_list, set_list, com_list);
+  _get_cmds_diff(diff, 0, diff.cfg1(0), diff.cfg2(0), cur_path, del_list,
+                 set_list, com_list);
 }
 
 void
 cnode::get_cmds(const CfgNode& cfg, vector<Cpath>& set_list,
                 vector<Cpath>& com_list)
 {
-  Cpath cur_path;
   vector<Cpath> del_list;
-  _get_cmds_diff(&cfg, &cfg, cur_path, del_list, set_list, com_list);
+  get_cmds_diff(cfg, cfg, del_list, set_list, com_list);
 }
 
 int
@@ -925,7 +1175,22 @@ cnode::showConfig(const string& cfg1, const string& cfg2,
                   const Cpath& path, bool show_def, bool hide_secret,
                   bool context_diff, bool show_cmds, bool ignore_edit)
 {
-  tr1::shared_ptr<CfgNode> aroot, wroot, croot1, croot2;
+  return showConfig(cfg1, cfg2, path, show_def, hide_secret, context_diff,
+                    show_cmds, ignore_edit, false);
+}
+
+/* if "filter" is true, "path" is the absolute root path when the edit level
+ * is not used (see below). otherwise it is ignored in that case, which is
+ * what the version above does.
+ */
+int
+cnode::showConfig(const string& cfg1, const string& cfg2,
+                  const Cpath& path, bool show_def, bool hide_secret,
+                  bool context_diff, bool show_cmds, bool ignore_edit,
+                  bool filter)
+{
+  tr1::shared_ptr<CfgNode> aroot, wroot, froot1, froot2, empty;
+  CfgNode *croot1 = NULL, *croot2 = NULL;
   tr1::shared_ptr<Cstore> cstore;
   Cpath rpath(path);
   Cpath cur_path;
@@ -936,9 +1201,17 @@ cnode::showConfig(const string& cfg1, const string& cfg2,
     cstore.reset(Cstore::createCstore(true));
     cstore->getEditLevel(cur_path);
   } else {
-    // at least one config file => don't use edit level and path
+    /* at least one config file => don't use edit level. with "filter",
+     * path is the absolute root path, and only that part of the config
+     * file(s) is built (see ConfigParser::setFilter()). otherwise path is
+     * not used.
+     */
     cstore.reset(Cstore::createCstore(false));
-    rpath.clear();
+    if (filter) {
+      cur_path = rpath;
+    } else {
+      rpath.clear();
+    }
   }
   if (cfg1 == ACTIVE_CFG || cfg2 == ACTIVE_CFG) {
     aroot.reset(new CfgNode(*cstore, rpath, true, true));
@@ -949,20 +1222,22 @@ cnode::showConfig(const string& cfg1, const string& cfg2,
   }
 
   if (cfg1 == ACTIVE_CFG) {
-    croot1 = aroot;
+    croot1 = aroot.get();
   } else if (cfg1 == WORKING_CFG) {
-    croot1 = wroot;
+    croot1 = wroot.get();
   } else {
-    croot1.reset(cparse::parse_file(cfg1.c_str(), *cstore));
+    froot1.reset(cparse::parse_file(cfg1.c_str(), *cstore, rpath));
+    croot1 = _get_file_subtree(froot1.get(), rpath, empty);
   }
   if (cfg2 == ACTIVE_CFG) {
-    croot2 = aroot;
+    croot2 = aroot.get();
   } else if (cfg2 == WORKING_CFG) {
-    croot2 = wroot;
+    croot2 = wroot.get();
   } else {
-    croot2.reset(cparse::parse_file(cfg2.c_str(), *cstore));
+    froot2.reset(cparse::parse_file(cfg2.c_str(), *cstore, rpath));
+    croot2 = _get_file_subtree(froot2.get(), rpath, empty);
   }
-  if (!croot1.get() || !croot2.get()) {
+  if (!croot1 || !croot2) {
     printf("Cannot parse specified config file(s)\n");
     return VYOS_CONFIG_PARSE_ERROR;
   }
@@ -1022,22 +1297,9 @@ cnode::findCfgNode(CfgNode *root, const Cpath& path, bool& is_value)
       }
     }
 
-    const vector<CfgNode *>& cnodes = node->getChildNodes();
-    bool found = false;
-    for (size_t j = 0; j < cnodes.size(); j++) {
-      if (cnodes[j]->isValue()) {
-        // tag value
-        found = (cnodes[j]->getValue() == path[i]);
-      } else {
-        // others
-        found = (cnodes[j]->getName() == path[i]);
-      }
-      if (found) {
-        node = cnodes[j];
-        break;
-      }
-    }
-    if (!found) {
+    // tag value or others. see CfgNode::getIndexKey().
+    node = node->findChildNode(path[i]);
+    if (!node) {
       return NULL;
     }
   }
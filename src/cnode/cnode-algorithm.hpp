@@ -21,6 +21,7 @@
 #include <string>
 
 #include <cstore/cpath.hpp>
+#include <cstore/cstore.hpp>
 #include <cnode/cnode.hpp>
 
 namespace cnode {
@@ -33,6 +34,62 @@ enum DiffState {
   DIFF_NULL
 };
 
+/* structural diff of two config trees. the diff is computed once and is
+ * stored as a compact "edit script": each entry pairs a node in cfg1 with
+ * the corresponding node in cfg2 (one of them is NULL if the node only
+ * exists in one of the trees). entries are in pre-order, and the children
+ * of each entry are in display order (see Cstore::sortNodes()). children
+ * are matched by a merge-join of the sorted child lists of the two nodes,
+ * so no per-node maps are needed.
+ *
+ * entry 0 is the two roots. the children of entry "i" are iterated with
+ *
+ *   for (size_t c = diff.firstChild(i); c < diff.end(i); c = diff.end(c))
+ *
+ * the diff does not modify the trees. the nodes are non-const only so that
+ * the commit tree can be built from them.
+ */
+class CfgDiff {
+public:
+  CfgDiff(const CfgNode& cfg1, const CfgNode& cfg2);
+
+  size_t size() const { return _script.size(); }
+  CfgNode *cfg1(size_t i) const { return _script[i].cfg1; }
+  CfgNode *cfg2(size_t i) const { return _script[i].cfg2; }
+  size_t firstChild(size_t i) const { return i + 1; }
+  // index of the entry following the subtree of entry i
+  size_t end(size_t i) const { return _script[i].end; }
+
+  /* get the nodes of child entry c given the nodes p1 and p2 of its parent
+   * entry as seen by the caller, i.e., after the caller has dropped any
+   * nodes it treats as nonexistent. a child node is NULL if the
+   * corresponding parent node is NULL. return false if both are NULL.
+   */
+  bool getChild(size_t c, const CfgNode *p1, const CfgNode *p2,
+                CfgNode *& c1, CfgNode *& c2) const {
+    c1 = (p1 ? _script[c].cfg1 : 0);
+    c2 = (p2 ? _script[c].cfg2 : 0);
+    return (c1 || c2);
+  }
+
+private:
+  struct Entry {
+    CfgNode *cfg1;
+    CfgNode *cfg2;
+    size_t end;
+    Entry(CfgNode *c1, CfgNode *c2) : cfg1(c1), cfg2(c2), end(0) {}
+  };
+
+  std::vector<Entry> _script;
+  cstore::Cstore::SortFuncT _sort_func;
+
+  void add_entry(CfgNode *cfg1, CfgNode *cfg2);
+  void add_run(const std::vector<CfgNode *>& cn1, size_t b1, size_t e1,
+               const std::vector<CfgNode *>& cn2, size_t b2, size_t e2);
+  void sort_children(const CfgNode *cfg, std::vector<CfgNode *>& cnodes);
+  size_t run_end(const std::vector<CfgNode *>& cnodes, size_t b) const;
+};
+
 bool cmp_multi_values(const CfgNode *cfg1, const CfgNode *cfg2,
                       std::vector<std::string>& values,
                       std::vector<DiffState>& pfxs);
@@ -46,6 +103,9 @@ void cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
 int show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                    cstore::Cpath& cur_path, bool show_def = false,
                    bool hide_secret = false, bool context_diff = false);
+int show_cfg_diff(const CfgDiff& diff, cstore::Cpath& cur_path,
+                  bool show_def = false, bool hide_secret = false,
+                  bool context_diff = false);
 int show_cfg(const CfgNode& cfg, bool show_def = false,
               bool hide_secret = false);
 
@@ -56,6 +116,10 @@ void get_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                    std::vector<cstore::Cpath>& del_list,
                    std::vector<cstore::Cpath>& set_list,
                    std::vector<cstore::Cpath>& com_list);
+void get_cmds_diff(const CfgDiff& diff,
+                   std::vector<cstore::Cpath>& del_list,
+                   std::vector<cstore::Cpath>& set_list,
+                   std::vector<cstore::Cpath>& com_list);
 void get_cmds(const CfgNode& cfg, std::vector<cstore::Cpath>& set_list,
               std::vector<cstore::Cpath>& com_list);
 
@@ -66,6 +130,10 @@ int showConfig(const std::string& cfg1, const std::string& cfg2,
                const cstore::Cpath& path, bool show_def = false,
                bool hide_secret = false, bool context_diff = false,
                bool show_cmds = false, bool ignore_edit = false);
+int showConfig(const std::string& cfg1, const std::string& cfg2,
+               const cstore::Cpath& path, bool show_def, bool hide_secret,
+               bool context_diff, bool show_cmds, bool ignore_edit,
+               bool filter);
 
 /* these functions provide the functionality necessary for the "config
  * file" shell API. basically the API uses the "cparse" interface to
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <deque>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <cnode/cnode.hpp>
+#include <cnode/cnode-snapshot.hpp>
+
+using namespace cnode;
+using namespace cstore;
+using namespace std;
+
+const char CfgSnapshot::C_SNAPSHOT_MAGIC[8]
+  = { 'V', 'Y', 'C', 'F', 'G', 'S', 'N', 'P' };
+
+////// public functions
+CfgSnapshot::~CfgSnapshot()
+{
+  close();
+}
+
+bool
+CfgSnapshot::open(const string& file, const string& stamp)
+{
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || static_cast<size_t>(st.st_size) < sizeof(SnapHeader)) {
+    ::close(fd);
+    return false;
+  }
+  void *m = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) {
+    return false;
+  }
+  _map = static_cast<char *>(m);
+  _map_len = st.st_size;
+  _hdr = reinterpret_cast<const SnapHeader *>(_map);
+  if (!check() || stamp != str(_hdr->stamp)) {
+    // not a valid snapshot or stale
+    close();
+    return false;
+  }
+  return true;
+}
+
+const CfgSnapshot::Node *
+CfgSnapshot::find(const Cpath& path) const
+{
+  if (!_map) {
+    return 0;
+  }
+  const Node *n = _nodes;
+  for (size_t i = 0; i < path.size(); i++) {
+    const Node *next = 0;
+    for (size_t j = 0; j < n->num_children; j++) {
+      const Node *c = child(n, j);
+      if (strcmp(str(c->key), path[i]) == 0) {
+        next = c;
+        break;
+      }
+    }
+    if (!next) {
+      return 0;
+    }
+    n = next;
+  }
+  return n;
+}
+
+////// private functions
+/* check that everything in the mapping is within bounds so that the
+ * accessors don't need to. children always come after their parent, so
+ * following children always terminates.
+ */
+bool
+CfgSnapshot::check()
+{
+  const SnapHeader *h = _hdr;
+  if (memcmp(h->magic, C_SNAPSHOT_MAGIC, sizeof(C_SNAPSHOT_MAGIC)) != 0
+      || h->version != C_SNAPSHOT_VERSION
+      || h->num_nodes < 1
+      || h->nodes_off > _map_len || h->nodes_off % sizeof(uint64_t) != 0
+      || (_map_len - h->nodes_off) / sizeof(Node) < h->num_nodes
+      || h->values_off > _map_len || h->values_off % sizeof(uint32_t) != 0
+      || (_map_len - h->values_off) / sizeof(uint32_t) < h->num_values
+      || h->strs_off > _map_len || h->strs_len < 1
+      || h->strs_len > _map_len - h->strs_off
+      || _map[h->strs_off + h->strs_len - 1] != 0
+      || h->stamp >= h->strs_len) {
+    return false;
+  }
+  _nodes = reinterpret_cast<const Node *>(_map + h->nodes_off);
+  _values = reinterpret_cast<const uint32_t *>(_map + h->values_off);
+  _strs = _map + h->strs_off;
+
+  for (uint32_t i = 0; i < h->num_nodes; i++) {
+    const Node& n = _nodes[i];
+    if (n.key >= h->strs_len || n.value >= h->strs_len
+        || n.comment >= h->strs_len) {
+      return false;
+    }
+    if (n.num_children > 0
+        && (n.first_child <= i || n.first_child > h->num_nodes
+            || n.num_children > h->num_nodes - n.first_child)) {
+      return false;
+    }
+    if (n.first_value > h->num_values
+        || n.num_values > h->num_values - n.first_value) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < h->num_values; i++) {
+    if (_values[i] >= h->strs_len) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+CfgSnapshot::close()
+{
+  if (_map) {
+    munmap(_map, _map_len);
+  }
+  _map = 0;
+  _map_len = 0;
+  _hdr = 0;
+  _nodes = 0;
+  _values = 0;
+  _strs = 0;
+}
+
+////// snapshot construction
+/* strings are interned in the string table, which starts with the empty
+ * string at offset 0.
+ */
+class StrTable {
+public:
+  StrTable() : _data(1, '\0') {};
+  uint32_t add(const string& s) {
+    if (s.empty()) {
+      return 0;
+    }
+    MapT<string, uint32_t>::iterator it = _offs.find(s);
+    if (it != _offs.end()) {
+      return it->second;
+    }
+    uint32_t off = _data.length();
+    _data.append(s.c_str(), s.length() + 1);
+    _offs[s] = off;
+    return off;
+  };
+  const string& data() const { return _data; };
+
+private:
+  string _data;
+  MapT<string, uint32_t> _offs;
+};
+
+static bool
+_write_all(FILE *f, const void *data, size_t len)
+{
+  return (len == 0 || fwrite(data, len, 1, f) == 1);
+}
+
+static bool
+_write_pad(FILE *f, uint64_t& off)
+{
+  static const char pad[sizeof(uint64_t)] = { 0 };
+  size_t npad = (sizeof(uint64_t) - (off % sizeof(uint64_t)))
+                % sizeof(uint64_t);
+  off += npad;
+  return _write_all(f, pad, npad);
+}
+
+bool
+CfgSnapshot::build(const CfgNode& root, const string& stamp,
+                   const string& file)
+{
+  StrTable strs;
+  vector<Node> nodes;
+  vector<uint32_t> values;
+
+  // breadth-first so that children are contiguous
+  deque<const CfgNode *> queue;
+  queue.push_back(&root);
+  while (!queue.empty()) {
+    const CfgNode *cn = queue.front();
+    queue.pop_front();
+    if (!cn->exists()) {
+      /* a node that doesn't exist (e.g., deactivated) only has its
+       * template, so it can't be stored. such a config is not snapshotted.
+       */
+      return false;
+    }
+
+    Node n;
+    memset(&n, 0, sizeof(n));
+    n.key = strs.add(cn->getIndexKey());
+    if (cn->isLeaf() && !cn->isMulti()) {
+      n.value = strs.add(cn->getValue());
+    }
+    n.comment = strs.add(cn->getComment());
+    n.flags = ((cn->isDefault() ? F_DEFAULT : 0)
+               | (cn->isDeactivated() ? F_DEACTIVATED : 0)
+               | (cn->isLeafTypeless() ? F_LEAF_TYPELESS : 0));
+    n.num_children = cn->numChildNodes();
+    n.first_child = nodes.size() + queue.size() + 1;
+    const vector<string>& vals = cn->getValues();
+    n.first_value = values.size();
+    n.num_values = vals.size();
+    for (size_t i = 0; i < vals.size(); i++) {
+      values.push_back(strs.add(vals[i]));
+    }
+    nodes.push_back(n);
+    for (size_t i = 0; i < cn->numChildNodes(); i++) {
+      queue.push_back(cn->getChildNodes()[i]);
+    }
+  }
+
+  char pid_str[16];
+  snprintf(pid_str, sizeof(pid_str), "%u", getpid());
+  string tmp_file = file + ".tmp." + pid_str;
+  FILE *f = fopen(tmp_file.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+
+  SnapHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, C_SNAPSHOT_MAGIC, sizeof(C_SNAPSHOT_MAGIC));
+  hdr.version = C_SNAPSHOT_VERSION;
+  hdr.stamp = strs.add(stamp);
+  hdr.num_nodes = nodes.size();
+  hdr.num_values = values.size();
+
+  uint64_t off = sizeof(hdr);
+  bool ret = (_write_all(f, &hdr, sizeof(hdr)) && _write_pad(f, off));
+  hdr.nodes_off = off;
+  ret = (ret && _write_all(f, &(nodes[0]), nodes.size() * sizeof(Node)));
+  off += nodes.size() * sizeof(Node);
+  hdr.values_off = off;
+  if (ret && values.size() > 0) {
+    ret = _write_all(f, &(values[0]), values.size() * sizeof(uint32_t));
+  }
+  off += values.size() * sizeof(uint32_t);
+  hdr.strs_off = off;
+  hdr.strs_len = strs.data().length();
+  ret = (ret && _write_all(f, strs.data().data(), strs.data().length()));
+
+  ret = (ret && fseek(f, 0, SEEK_SET) == 0
+         && _write_all(f, &hdr, sizeof(hdr)));
+  ret = (ret && fflush(f) == 0 && fsync(fileno(f)) == 0);
+  ret = (fclose(f) == 0 && ret);
+  if (ret) {
+    ret = (chmod(tmp_file.c_str(), 0644) == 0
+           && rename(tmp_file.c_str(), file.c_str()) == 0);
+  }
+  if (!ret) {
+    unlink(tmp_file.c_str());
+  }
+  return ret;
+}
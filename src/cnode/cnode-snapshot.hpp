@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CNODE_SNAPSHOT_HPP_
+#define _CNODE_SNAPSHOT_HPP_
+#include <string>
+
+#include <stdint.h>
+
+#include <cstore/cpath.hpp>
+
+namespace cnode {
+
+class CfgNode;
+
+/* binary snapshot of a config tree (normally the active config).
+ *
+ * the snapshot is a single file that is mapped read-only. nodes are fixed
+ * size records in breadth-first order so that the children of a node are
+ * contiguous, and they refer to each other by index. all strings are
+ * stored once in a string table and referred to by offset.
+ *
+ * a snapshot records a "stamp" identifying the state of the config it was
+ * taken from (see Cstore::getActiveSnapshotInfo()). open() fails if the
+ * stamp does not match, so a stale snapshot is never used.
+ *
+ * only what cannot be derived from the templates is stored. the node
+ * types are taken from the templates when the tree is loaded (see
+ * CfgNode).
+ */
+class CfgSnapshot {
+public:
+  struct Node {
+    uint32_t key;       // path component (value for tag values)
+    uint32_t value;     // value of single-value leaf node
+    uint32_t comment;
+    uint32_t flags;
+    uint32_t first_child;
+    uint32_t num_children;
+    uint32_t first_value;  // values of multi-value leaf node
+    uint32_t num_values;
+  };
+  static const uint32_t F_DEFAULT = 0x1;
+  static const uint32_t F_DEACTIVATED = 0x2;
+  static const uint32_t F_LEAF_TYPELESS = 0x4;
+
+  CfgSnapshot() : _map(0), _map_len(0), _hdr(0), _nodes(0), _values(0),
+                  _strs(0) {};
+  ~CfgSnapshot();
+
+  /* open the snapshot file "file" taken with stamp "stamp". returns false
+   * if the file does not exist, is not a valid snapshot, or has a
+   * different stamp.
+   */
+  bool open(const std::string& file, const std::string& stamp);
+
+  /* return the node at "path" (relative to the root of the snapshot), or
+   * 0 if not found.
+   */
+  const Node *find(const cstore::Cpath& path) const;
+
+  const Node *child(const Node *n, size_t i) const {
+    return &(_nodes[n->first_child + i]);
+  };
+  const char *str(uint32_t off) const { return (_strs + off); };
+  const char *value(const Node *n, size_t i) const {
+    return str(_values[n->first_value + i]);
+  };
+
+  /* write the tree rooted at "root" with stamp "stamp" into "file". the
+   * file is replaced atomically. fails if the tree contains nodes that
+   * don't exist (see CfgNode::exists()).
+   */
+  static bool build(const CfgNode& root, const std::string& stamp,
+                    const std::string& file);
+
+  static const uint32_t C_SNAPSHOT_VERSION = 1;
+
+private:
+  struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t stamp;
+    uint32_t num_nodes;
+    uint32_t num_values;
+    uint64_t nodes_off;
+    uint64_t values_off;
+    uint64_t strs_off;
+    uint64_t strs_len;
+  };
+  static const char C_SNAPSHOT_MAGIC[8];
+
+  char *_map;
+  size_t _map_len;
+  const SnapHeader *_hdr;
+  const Node *_nodes;
+  const uint32_t *_values;
+  const char *_strs;
+
+  // not copyable
+  CfgSnapshot(const CfgSnapshot&);
+  CfgSnapshot& operator=(const CfgSnapshot&);
+
+  bool check();
+  void close();
+};
+
+} // namespace cnode
+
+#endif /* _CNODE_SNAPSHOT_HPP_ */
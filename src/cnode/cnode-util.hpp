@@ -17,14 +17,26 @@
 #ifndef _CNODE_UTIL_HPP_
 #define _CNODE_UTIL_HPP_
 #include <vector>
+#include <string>
+#include <tr1/memory>
+
+#include <cstore/util.hpp>
 
 namespace cnode {
 
+/* tree node. the child nodes are kept in order. in addition, children can
+ * be looked up by key (see findChildNode()), in which case the derived
+ * class N must provide "getIndexKey()".
+ */
 template<class N> class TreeNode {
 public:
   typedef N node_type;
   typedef std::vector<N *> nodes_vec_type;
   typedef typename nodes_vec_type::iterator nodes_iter_type;
+  typedef cstore::MapT<std::string, N *> nodes_index_type;
+
+  // min number of children for building the index
+  static const size_t C_INDEX_MIN_NODES = 8;
 
   TreeNode() : _parent(0) {}
   virtual ~TreeNode() { 
@@ -40,10 +52,17 @@ public:
   node_type *getParent() const { return _parent; }
   node_type *childAt(size_t idx) { return _child_nodes[idx]; }
   void setParent(node_type *p) { _parent = p; }
-  void clearChildNodes() { _child_nodes.clear(); }
+  void clearChildNodes() {
+    _child_nodes.clear();
+    _child_index.reset();
+  }
   void addChildNode(node_type *cnode) {
     _child_nodes.push_back(cnode);
     cnode->_parent = static_cast<node_type *>(this);
+    if (_child_index.get()) {
+      // first one wins (same as scanning)
+      _child_index->insert(std::make_pair(cnode->getIndexKey(), cnode));
+    }
   }
 
   bool removeChildNode(node_type *cnode) {
@@ -51,6 +70,8 @@ public:
     while (it != _child_nodes.end()) {
       if (*it == cnode) {
         _child_nodes.erase(it);
+        // another child may have the same key, so just rebuild when needed
+        _child_index.reset();
         return true;
       }
       ++it;
@@ -58,6 +79,30 @@ public:
     return false;
   }
 
+  /* return the first child whose key is "key", or 0 if not found. if there
+   * are enough children, an index is built on first use and maintained
+   * as children are added, so lookups don't need to scan the children.
+   */
+  node_type *findChildNode(const std::string& key) const {
+    if (!_child_index.get()) {
+      if (_child_nodes.size() < C_INDEX_MIN_NODES) {
+        for (size_t i = 0; i < _child_nodes.size(); i++) {
+          if (_child_nodes[i]->getIndexKey() == key) {
+            return _child_nodes[i];
+          }
+        }
+        return 0;
+      }
+      _child_index.reset(new nodes_index_type);
+      for (size_t i = 0; i < _child_nodes.size(); i++) {
+        _child_index->insert(std::make_pair(_child_nodes[i]->getIndexKey(),
+                                            _child_nodes[i]));
+      }
+    }
+    typename nodes_index_type::const_iterator it = _child_index->find(key);
+    return (it != _child_index->end() ? it->second : 0);
+  }
+
   bool detachFromParent() {
     if (!_parent) {
       // not attached to tree
@@ -75,11 +120,13 @@ public:
       _child_nodes[i]->_parent = 0;
     }
     _child_nodes.clear();
+    _child_index.reset();
   }
 
 private:
   node_type *_parent;
   nodes_vec_type _child_nodes;
+  mutable std::tr1::shared_ptr<nodes_index_type> _child_index;
 };
 
 } // namespace cnode
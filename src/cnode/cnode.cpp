@@ -20,6 +20,8 @@
 #include <string>
 #include <algorithm>
 #include <memory>
+#include <new>
+#include <tr1/unordered_set>
 
 #include <cli_cstore.h>
 #include <cnode/cnode.hpp>
@@ -28,6 +30,69 @@ using namespace cnode;
 using namespace cstore;
 
 
+////// allocation
+/* nodes are built and torn down a whole tree at a time (e.g., doCommit()
+ * builds two full trees), so they are carved out of large chunks, and
+ * freed nodes are kept for the next tree. this makes allocation cheap.
+ *
+ * the free list is LIFO: a new chunk is handed out in address order, but
+ * freed nodes are reused most recently freed first, so the next tree is
+ * not necessarily laid out in address order.
+ */
+struct PoolNode {
+  PoolNode *next;
+};
+static const size_t C_POOL_CHUNK_NODES = 256;
+static PoolNode *_pool_free = NULL;
+
+void *
+CfgNode::operator new(size_t size)
+{
+  if (size != sizeof(CfgNode)) {
+    // derived class
+    return ::operator new(size);
+  }
+  if (!_pool_free) {
+    char *chunk = static_cast<char *>(::operator new(size
+                                                     * C_POOL_CHUNK_NODES));
+    // hand out a new chunk in address order
+    for (size_t i = C_POOL_CHUNK_NODES; i > 0; i--) {
+      PoolNode *n = reinterpret_cast<PoolNode *>(chunk + ((i - 1) * size));
+      n->next = _pool_free;
+      _pool_free = n;
+    }
+  }
+  PoolNode *n = _pool_free;
+  _pool_free = n->next;
+  return n;
+}
+
+void
+CfgNode::operator delete(void *p, size_t size)
+{
+  if (!p) {
+    return;
+  }
+  if (size != sizeof(CfgNode)) {
+    ::operator delete(p);
+    return;
+  }
+  PoolNode *n = static_cast<PoolNode *>(p);
+  n->next = _pool_free;
+  _pool_free = n;
+}
+
+/* node names come from the templates, so there are relatively few distinct
+ * ones, and each is stored only once.
+ */
+const string *
+CfgNode::intern_name(const string& name)
+{
+  static tr1::unordered_set<string> names;
+  return &(*(names.insert(name).first));
+}
+
+
 ////// constructors/destructors
 // for parser
 CfgNode::CfgNode(Cpath& path_comps, char *name, char *val, char *comment,
@@ -35,7 +100,7 @@ CfgNode::CfgNode(Cpath& path_comps, char *name, char *val, char *comment,
   : TreeNode<CfgNode>(),
     _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
     _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
-    _is_invalid(false), _exists(true)
+    _is_invalid(false), _exists(true), _name(intern_name(""))
 {
   if (name && name[0]) {
     // name must be non-empty
@@ -46,95 +111,54 @@ CfgNode::CfgNode(Cpath& path_comps, char *name, char *val, char *comment,
     path_comps.push(val);
   }
 
-  while (1) {
-    if (path_comps.size() == 0) {
-      // nothing to do for root node
-      break;
-    }
-
-    setTmpl(cstore->parseTmpl(path_comps, false));
-    if (getTmpl().get()) {
-      // got the def
-      _is_tag = getTmpl()->isTag();
-      _is_leaf = (!_is_tag && !getTmpl()->isTypeless());
-
-      // match constructor from cstore (leaf node never _is_value)
-      _is_value = (getTmpl()->isValue() && !_is_leaf);
-      _is_multi = getTmpl()->isMulti();
-
-      /* XXX given the current definition of "default" (i.e., the
-       * "post-bug 1219" definition), the concept of "default" doesn't
-       * really apply to config files. however, if in the future we
-       * do go back to the original, simpler definition of "default"
-       * (which IMO is the right thing to do), the "default handling"
-       * here and elsewhere in the backend library will need to be
-       * revamped.
-       *
-       * in fact, in that case pretty much the only place that need to
-       * worry about "default" is in the "output" (i.e., "show")
-       * processing, and even there the only thing that needs to be
-       * done is to compare the current value with the "default value"
-       * in the template.
-       */
-      _is_default = false;
-      _is_deactivated = deact;
-
-      vector<string> tcnodes;
-      cstore->tmplGetChildNodes(path_comps, tcnodes);
-      if (tcnodes.size() == 0) {
-        // typeless leaf node
-        _is_leaf_typeless = true;
-      }
-
-      if (comment) {
-        _comment = comment;
-      }
-      // ignore return
-    } else {
-      // not a valid node
-      _is_invalid = true;
-      if (tag_if_invalid) {
-        /* this is only used when the parser is creating a "tag node". force
-         * the node to be tag since we don't have template for invalid node.
-         */
-        _is_tag = true;
-      }
-      if (val) {
-        /* if parser got value for the invalid node, always treat it as
-         * "tag value" for simplicity.
-         */
-        _is_tag = true;
-        _is_value = true;
-      }
-      break;
-    }
+  if (path_comps.size() == 0) {
+    // nothing to do for root node
+    return;
+  }
 
-    break;
+  tr1::shared_ptr<Ctemplate> def(cstore->parseTmpl(path_comps, false));
+  bool leaf_typeless = false;
+  if (def.get()) {
+    vector<string> tcnodes;
+    cstore->tmplGetChildNodes(path_comps, tcnodes);
+    leaf_typeless = (tcnodes.size() == 0);
   }
 
-  // restore path_comps. also set value/name for both valid and invalid nodes.
+  // restore path_comps
   if (val) {
-    if (_is_multi) {
-      _values.push_back(val);
-    } else {
-      _value = val;
-    }
     path_comps.pop();
   }
   if (name && name[0]) {
-    _name = name;
     path_comps.pop();
   }
+  set_parsed(def, leaf_typeless, name, val, comment, deact, tag_if_invalid);
+}
+
+// for parser with resolved template
+CfgNode::CfgNode(const tr1::shared_ptr<Ctemplate>& def, bool leaf_typeless,
+                 const char *name, const char *val, const char *comment,
+                 int deact, bool tag_if_invalid)
+  : TreeNode<CfgNode>(),
+    _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
+    _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
+    _is_invalid(false), _exists(true), _name(intern_name(""))
+{
+  set_parsed(def, leaf_typeless, name, val, comment, deact, tag_if_invalid);
 }
 
 // for active/working config
 CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
-                 bool recursive)
+                 bool recursive, bool use_snapshot)
   : TreeNode<CfgNode>(),
     _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
     _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
-    _is_invalid(false), _exists(true)
+    _is_invalid(false), _exists(true), _name(intern_name(""))
 {
+  if (active && recursive && use_snapshot
+      && load_snapshot(cstore, path_comps)) {
+    return;
+  }
+
   /* first get the def (only if path is not empty). if path is empty, i.e.,
    * "root", treat it as an intermediate node.
    */
@@ -172,7 +196,7 @@ CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
 
   // handle leaf node (note path_comps must be non-empty if this is leaf)
   if (_is_leaf) {
-    _name = path_comps[path_comps.size() - 1];
+    _name = intern_name(path_comps[path_comps.size() - 1]);
     if (_is_multi) {
       // multi-value node
       cstore.cfgPathGetValuesDA(path_comps, _values, active, true);
@@ -188,11 +212,12 @@ CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
   // handle intermediate (typeless) or tag
   if (_is_value) {
     // tag value
-    _name = path_comps[path_comps.size() - 2];
+    _name = intern_name(path_comps[path_comps.size() - 2]);
     _value = path_comps[path_comps.size() - 1];
   } else {
     // tag node or typeless node
-    _name = (path_comps.size() > 0 ? path_comps[path_comps.size() - 1] : "");
+    _name = intern_name(path_comps.size() > 0
+                        ? path_comps[path_comps.size() - 1] : "");
   }
 
   // check child nodes
@@ -217,9 +242,210 @@ CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
   // recurse
   for (size_t i = 0; i < cnodes.size(); i++) {
     path_comps.push(cnodes[i]);
-    CfgNode *cn = new CfgNode(cstore, path_comps, active, recursive);
+    CfgNode *cn = new CfgNode(cstore, path_comps, active, recursive, false);
     addChildNode(cn);
     path_comps.pop();
   }
 }
 
+// for snapshot
+CfgNode::CfgNode()
+  : TreeNode<CfgNode>(),
+    _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
+    _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
+    _is_invalid(false), _exists(true), _name(intern_name(""))
+{
+}
+
+
+////// private functions
+/* get the templates of the nodes in the snapshot subtree rooted at "sn"
+ * (at "path_comps") in pre-order. return false if any node is not valid,
+ * e.g., if the templates have changed since the snapshot was taken.
+ */
+static bool
+_get_snapshot_tmpls(Cstore& cstore, const CfgSnapshot& snap,
+                    const CfgSnapshot::Node *sn, Cpath& path_comps,
+                    vector<tr1::shared_ptr<Ctemplate> >& tmpls)
+{
+  tr1::shared_ptr<Ctemplate> def;
+  if (path_comps.size() > 0) {
+    def = cstore.parseTmpl(path_comps, false);
+    if (!def.get()) {
+      return false;
+    }
+  }
+  tmpls.push_back(def);
+  for (size_t i = 0; i < sn->num_children; i++) {
+    const CfgSnapshot::Node *c = snap.child(sn, i);
+    path_comps.push(snap.str(c->key));
+    bool ok = _get_snapshot_tmpls(cstore, snap, c, path_comps, tmpls);
+    path_comps.pop();
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* load the active config at "path_comps" from the snapshot. return false
+ * if the snapshot is not usable, in which case nothing has been changed.
+ */
+bool
+CfgNode::load_snapshot(Cstore& cstore, Cpath& path_comps)
+{
+  string file, stamp;
+  if (!cstore.getActiveSnapshotInfo(file, stamp)) {
+    return false;
+  }
+  CfgSnapshot snap;
+  if (!snap.open(file, stamp)) {
+    return false;
+  }
+
+  // the snapshot is of the whole config, and path_comps is at edit level
+  Cpath spath;
+  cstore.getEditLevel(spath);
+  for (size_t i = 0; i < path_comps.size(); i++) {
+    spath.push(path_comps[i]);
+  }
+  const CfgSnapshot::Node *sn = snap.find(spath);
+  if (!sn) {
+    // e.g., path doesn't exist or is a value
+    return false;
+  }
+
+  TmplVecT tmpls;
+  if (!_get_snapshot_tmpls(cstore, snap, sn, path_comps, tmpls)) {
+    return false;
+  }
+  size_t tidx = 0;
+  set_snapshot(snap, sn, path_comps, tmpls, tidx);
+  return true;
+}
+
+/* set up node from snapshot node "sn" at "path_comps". this follows the
+ * constructor for active/working config above.
+ */
+void
+CfgNode::set_snapshot(const CfgSnapshot& snap, const CfgSnapshot::Node *sn,
+                      Cpath& path_comps, const TmplVecT& tmpls, size_t& tidx)
+{
+  const tr1::shared_ptr<Ctemplate>& def = tmpls[tidx++];
+  if (path_comps.size() > 0) {
+    setTmpl(def);
+    _is_value = def->isValue();
+    _is_tag = def->isTag();
+    _is_leaf = (!_is_tag && !def->isTypeless());
+    _is_multi = def->isMulti();
+    _is_default = (sn->flags & CfgSnapshot::F_DEFAULT);
+    _is_deactivated = (sn->flags & CfgSnapshot::F_DEACTIVATED);
+    _comment = snap.str(sn->comment);
+  }
+
+  if (_is_leaf) {
+    _name = intern_name(path_comps[path_comps.size() - 1]);
+    if (_is_multi) {
+      for (size_t i = 0; i < sn->num_values; i++) {
+        _values.push_back(snap.value(sn, i));
+      }
+    } else {
+      _value = snap.str(sn->value);
+    }
+    return;
+  }
+
+  if (_is_value) {
+    _name = intern_name(path_comps[path_comps.size() - 2]);
+    _value = path_comps[path_comps.size() - 1];
+  } else {
+    _name = intern_name(path_comps.size() > 0
+                        ? path_comps[path_comps.size() - 1] : "");
+  }
+
+  if (sn->num_children == 0) {
+    _is_leaf_typeless = (sn->flags & CfgSnapshot::F_LEAF_TYPELESS);
+    return;
+  }
+  for (size_t i = 0; i < sn->num_children; i++) {
+    const CfgSnapshot::Node *c = snap.child(sn, i);
+    path_comps.push(snap.str(c->key));
+    CfgNode *cn = new CfgNode();
+    cn->set_snapshot(snap, c, path_comps, tmpls, tidx);
+    addChildNode(cn);
+    path_comps.pop();
+  }
+}
+/* set up a parsed node given its template "def" (NULL if the node is not
+ * valid). see the parser constructors above.
+ */
+void
+CfgNode::set_parsed(const tr1::shared_ptr<Ctemplate>& def,
+                    bool leaf_typeless, const char *name, const char *val,
+                    const char *comment, int deact, bool tag_if_invalid)
+{
+  setTmpl(def);
+  if (def.get()) {
+    // got the def
+    _is_tag = def->isTag();
+    _is_leaf = (!_is_tag && !def->isTypeless());
+
+    // match constructor from cstore (leaf node never _is_value)
+    _is_value = (def->isValue() && !_is_leaf);
+    _is_multi = def->isMulti();
+
+    /* XXX given the current definition of "default" (i.e., the
+     * "post-bug 1219" definition), the concept of "default" doesn't
+     * really apply to config files. however, if in the future we
+     * do go back to the original, simpler definition of "default"
+     * (which IMO is the right thing to do), the "default handling"
+     * here and elsewhere in the backend library will need to be
+     * revamped.
+     *
+     * in fact, in that case pretty much the only place that need to
+     * worry about "default" is in the "output" (i.e., "show")
+     * processing, and even there the only thing that needs to be
+     * done is to compare the current value with the "default value"
+     * in the template.
+     */
+    _is_default = false;
+    _is_deactivated = deact;
+
+    if (leaf_typeless) {
+      // typeless leaf node
+      _is_leaf_typeless = true;
+    }
+
+    if (comment) {
+      _comment = comment;
+    }
+  } else {
+    // not a valid node
+    _is_invalid = true;
+    if (tag_if_invalid) {
+      /* this is only used when the parser is creating a "tag node". force
+       * the node to be tag since we don't have template for invalid node.
+       */
+      _is_tag = true;
+    }
+    if (val) {
+      /* if parser got value for the invalid node, always treat it as
+       * "tag value" for simplicity.
+       */
+      _is_tag = true;
+      _is_value = true;
+    }
+  }
+
+  // set value/name for both valid and invalid nodes.
+  if (val) {
+    if (_is_multi) {
+      _values.push_back(val);
+    } else {
+      _value = val;
+    }
+  }
+  if (name && name[0]) {
+    _name = intern_name(name);
+  }
+}
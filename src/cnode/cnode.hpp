@@ -22,6 +22,7 @@
 
 #include <cstore/cstore.hpp>
 #include <cnode/cnode-util.hpp>
+#include <cnode/cnode-snapshot.hpp>
 #include <commit/commit-algorithm.hpp>
 
 namespace cnode {
@@ -31,12 +32,27 @@ public:
   // constructor for parser
   CfgNode(cstore::Cpath& path_comps, char *name, char *val, char *comment,
           int deact, cstore::Cstore *cstore, bool tag_if_invalid = false);
-  // constructor for active/working config
+  /* constructor for parser when the template has already been resolved.
+   * "def" is the template at the node (NULL if invalid), and "leaf_typeless"
+   * is whether the template has no child nodes.
+   */
+  CfgNode(const std::tr1::shared_ptr<cstore::Ctemplate>& def,
+          bool leaf_typeless, const char *name, const char *val,
+          const char *comment, int deact, bool tag_if_invalid = false);
+  /* constructor for active/working config. a recursive read of the active
+   * config is loaded from the active config snapshot if it is up to date
+   * (see CfgSnapshot), unless "use_snapshot" is false.
+   */
   CfgNode(cstore::Cstore& cstore, cstore::Cpath& path_comps,
-          bool active = false, bool recursive = true);
+          bool active = false, bool recursive = true,
+          bool use_snapshot = true);
 
   ~CfgNode() {};
 
+  // nodes are allocated from a pool (see cnode.cpp)
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
+
   bool isTag() const { return _is_tag; }
   bool isTagNode() const { return (_is_tag && !_is_value); }
   bool isLeaf() const { return _is_leaf; }
@@ -49,13 +65,17 @@ public:
   bool isEmpty() const { return (!_is_leaf && numChildNodes() == 0); }
   bool exists() const { return _exists; }
 
-  const std::string& getName() const { return _name; }
+  const std::string& getName() const { return *_name; }
   const std::string& getValue() const { return _value; }
   const std::vector<std::string>& getValues() const { return _values; }
   const std::string& getComment() const { return _comment; }
+  // key for finding the node among its siblings (see TreeNode)
+  const std::string& getIndexKey() const {
+    return (_is_value ? _value : *_name);
+  }
 
-  void addMultiValue(char *val) { _values.push_back(val); }
-  void setValue(char *val) { _value = val; }
+  void addMultiValue(const char *val) { _values.push_back(val); }
+  void setValue(const char *val) { _value = val; }
 
   // XXX testing
   void rprint(size_t lvl) {
@@ -70,6 +90,21 @@ public:
   }
 
 private:
+  // for nodes loaded from snapshot
+  CfgNode();
+
+  static const std::string *intern_name(const std::string& name);
+
+  typedef std::vector<std::tr1::shared_ptr<cstore::Ctemplate> > TmplVecT;
+  bool load_snapshot(cstore::Cstore& cstore, cstore::Cpath& path_comps);
+  void set_snapshot(const CfgSnapshot& snap, const CfgSnapshot::Node *sn,
+                    cstore::Cpath& path_comps, const TmplVecT& tmpls,
+                    size_t& tidx);
+
+  void set_parsed(const std::tr1::shared_ptr<cstore::Ctemplate>& def,
+                  bool leaf_typeless, const char *name, const char *val,
+                  const char *comment, int deact, bool tag_if_invalid);
+
   bool _is_tag;
   bool _is_leaf;
   bool _is_multi;
@@ -79,7 +114,7 @@ private:
   bool _is_leaf_typeless;
   bool _is_invalid;
   bool _exists;
-  std::string _name;
+  const std::string *_name; // interned (see intern_name())
   std::string _value;
   std::vector<std::string> _values;
   std::string _comment;
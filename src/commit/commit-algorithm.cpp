@@ -15,14 +15,21 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <string>
+#include <map>
+#include <fstream>
+#include <algorithm>
 #include <chrono>
 
 #include <cli_cstore.h>
 #include <commit/commit-algorithm.hpp>
+#include <commit/commit-trace.h>
 #include <cnode/cnode-algorithm.hpp>
 
 using namespace commit;
@@ -61,6 +68,18 @@ int stack_depth = 0;
 
 
 ////// static
+/* commit plan (see showCommitPlan()). while a plan is being collected,
+ * template actions are recorded in the plan instead of being executed.
+ */
+struct PlanAction {
+  vtw_act_type act;
+  string disp;
+  string tmpl;
+  PlanAction(vtw_act_type a, const Cpath& d, const string& t)
+    : act(a), disp(d.to_string()), tmpl(t) {}
+};
+static vector<PlanAction> *commit_plan = NULL;
+
 static const char *commit_hook_dirs[3] = {
   "/etc/commit/pre-hooks.d",
   "/etc/commit/post-hooks.d",
@@ -313,6 +332,18 @@ _exec_tmpl_actions(Cstore& cs, CommitState s, char *at_str,
     break;
   }
 
+  string tmpl;
+  if (commit_plan) {
+    // dry run => just record the action
+    cs.getTmplPathStr(path, tmpl);
+    commit_plan->push_back(PlanAction(act, disp_path, tmpl));
+    return true;
+  }
+
+  TraceScope trace("action", act_type_to_name(act), disp_path);
+  if (trace.enabled() && cs.getTmplPathStr(path, tmpl)) {
+    trace.setTmpl(tmpl);
+  }
   TRACE_INIT("Executing the \"%s\" ...", disp_path.to_string().c_str());
   setenv("COMMIT_ACTION", aenv, 1);
   set_in_delete_action((act == delete_act));
@@ -550,6 +581,7 @@ _set_commit_subtree_changed(CfgNode& node)
 static bool
 _commit_check_cfg_node(Cstore& cs, CfgNode *node, CommittedPathListT& clist)
 {
+  TraceScope trace("prio", "check");
   vector<CfgNode *> nodelist;
   _commit_tree_traversal(node, false, PRE_ORDER, nodelist, true);
   for (size_t i = 0; i < nodelist.size(); i++) {
@@ -596,6 +628,7 @@ _commit_check_cfg_node(Cstore& cs, CfgNode *node, CommittedPathListT& clist)
 static bool
 _commit_exec_cfg_node(Cstore& cs, CfgNode *node)
 {
+  TraceScope trace("prio", "exec");
   if (!node->commitSubtreeChanged()) {
     // nothing changed => nop
     return true;
@@ -699,6 +732,9 @@ _commit_exec_cfg_node(Cstore& cs, CfgNode *node)
 static bool
 _commit_exec_prio_subtree(Cstore& cs, PrioNode *proot)
 {
+  char tname[32];
+  snprintf(tname, sizeof(tname), "priority %u", proot->getPriority());
+  TraceScope trace("prio", tname, proot->getCommitPath());
   CfgNode *cfg = proot->getCfgNode();
   CommittedPathListT clist;
   bool ret = false;
@@ -728,8 +764,8 @@ _commit_exec_prio_subtree(Cstore& cs, PrioNode *proot)
       if (!ret)
           goto commit_failed;
     }
-    // subtree succeeded, mark nodes committed
-    for (size_t i = 0; i < clist.size(); i++) {
+    // subtree succeeded, mark nodes committed (unless dry run)
+    for (size_t i = 0; !commit_plan && i < clist.size(); i++) {
       if (!cs.markCfgPathCommitted(*(clist[i].second.get()),
                                    (clist[i].first
                                     == COMMIT_STATE_DELETED))) {
@@ -746,6 +782,154 @@ commit_failed:
   return false;
 }
 
+/* parallel commit.
+ *
+ * prio subtrees with the same priority have no defined ordering among
+ * them, so the ones that do not overlap (i.e., neither is an ancestor of
+ * the other in the prio tree) can be committed concurrently. each of them
+ * is committed in a forked child (actions are external programs, and the
+ * process state they depend on such as environment and output
+ * redirection is per-process anyway), and the outcome is then recorded in
+ * the prio tree by the parent, so success/failure accounting is the same
+ * as for serial commit.
+ *
+ * the child also reports whether it marked the subtree "changed" (see
+ * _set_commit_subtree_changed()), and the parent marks the ancestors
+ * accordingly, since the parent prio subtrees (committed later) depend on
+ * it. var refs set by the children are in the config, but the parent may
+ * have memoized the old values, so its var ref cache is cleared after the
+ * batch.
+ *
+ * this is enabled by setting the environment variable to the max number
+ * of concurrent subtrees.
+ */
+static const char *C_ENV_COMMIT_PARALLEL = "VYATTA_COMMIT_PARALLEL";
+// exit status bits of a child committing a prio subtree
+static const int C_BATCH_FAILED = 1;
+static const int C_BATCH_CHANGED = 2;
+
+static size_t
+_get_commit_parallel_jobs()
+{
+  const char *jstr = getenv(C_ENV_COMMIT_PARALLEL);
+  if (!jstr) {
+    return 1;
+  }
+  int jobs = atoi(jstr);
+  return (jobs > 1 ? jobs : 1);
+}
+
+static bool
+_is_prio_ancestor(PrioNode *a, PrioNode *n)
+{
+  for (PrioNode *p = n->getParent(); p; p = p->getParent()) {
+    if (p == a) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* get the next batch of prio subtrees from the queue, i.e., the ones at
+ * the top with the same priority that do not overlap.
+ */
+template<class QueueT> static void
+_get_commit_prio_batch(QueueT& q, vector<PrioNode *>& batch)
+{
+  batch.clear();
+  while (!q.empty()) {
+    PrioNode *p = q.top();
+    if (!batch.empty() && p->getPriority() != batch[0]->getPriority()) {
+      break;
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (_is_prio_ancestor(batch[i], p) || _is_prio_ancestor(p, batch[i])) {
+        // overlap => must be done after the current batch
+        return;
+      }
+    }
+    batch.push_back(p);
+    q.pop();
+  }
+}
+
+/* commit a batch of prio subtrees using at most "jobs" children.
+ * "remaining" is the number of subtrees left in the commit (including the
+ * batch) and "results" will contain the outcome of each subtree.
+ */
+static void
+_commit_exec_prio_batch(Cstore& cs, vector<PrioNode *>& batch, size_t jobs,
+                        size_t remaining, vector<bool>& results)
+{
+  results.assign(batch.size(), false);
+  TraceScope trace("prio", "batch");
+  if (batch.size() == 1 || jobs < 2) {
+    for (size_t i = 0; i < batch.size(); i++) {
+      set_if_last(remaining - i);
+      results[i] = _commit_exec_prio_subtree(cs, batch[i]);
+    }
+    return;
+  }
+
+  map<pid_t, size_t> running;
+  size_t next = 0;
+  fflush(NULL);
+  while (next < batch.size() || !running.empty()) {
+    while (next < batch.size() && running.size() < jobs) {
+      set_if_last(remaining - next);
+      pid_t pid = fork();
+      if (pid == 0) {
+        // child
+        bool ok = _commit_exec_prio_subtree(cs, batch[next]);
+        CfgNode *cn = batch[next]->getCfgNode();
+        bool changed = (cn && cn->commitSubtreeChanged());
+        fflush(NULL);
+        _exit((ok ? 0 : C_BATCH_FAILED) | (changed ? C_BATCH_CHANGED : 0));
+      }
+      if (pid < 0) {
+        // can't fork. just do it here.
+        results[next] = _commit_exec_prio_subtree(cs, batch[next]);
+        ++next;
+        continue;
+      }
+      running[pid] = next++;
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // lost track of the children => consider them failed
+      for (map<pid_t, size_t>::iterator it = running.begin();
+           it != running.end(); ++it) {
+        batch[it->second]->setSucceeded(false);
+      }
+      running.clear();
+      continue;
+    }
+    map<pid_t, size_t>::iterator it = running.find(pid);
+    if (it == running.end()) {
+      continue;
+    }
+    size_t i = it->second;
+    running.erase(it);
+    int code = (WIFEXITED(status) ? WEXITSTATUS(status) : C_BATCH_FAILED);
+    results[i] = ((code & C_BATCH_FAILED) == 0);
+    // record the outcome in the prio tree
+    batch[i]->setSucceeded(results[i]);
+    CfgNode *cn = batch[i]->getCfgNode();
+    if (cn && (code & C_BATCH_CHANGED)) {
+      _set_commit_subtree_changed(*cn);
+    }
+  }
+  cs.clearVarRefCache();
+}
+
 static CfgNode *
 _get_commit_leaf_node(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path,
                       bool& is_leaf)
@@ -812,14 +996,13 @@ _get_commit_leaf_node(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path,
 }
 
 static CfgNode *
-_get_commit_other_node(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path)
-{
-  string name, value;
-  bool not_tag_node, is_value, is_leaf_typeless;
-  vector<CfgNode *> rcnodes1, rcnodes2;
-  cnode::cmp_non_leaf_nodes(cfg1, cfg2, rcnodes1, rcnodes2, not_tag_node,
-                            is_value, is_leaf_typeless, name, value);
+_get_commit_tree(const CfgDiff& diff, size_t idx, CfgNode *cfg1,
+                 CfgNode *cfg2, const Cpath& cur_path);
 
+static CfgNode *
+_get_commit_other_node(const CfgDiff& diff, size_t idx, CfgNode *cfg1,
+                       CfgNode *cfg2, const Cpath& cur_path)
+{
   if (!cfg1) {
     return _create_commit_cfg_node(*cfg2, cur_path, COMMIT_STATE_ADDED);
   } else if (!cfg2) {
@@ -828,9 +1011,13 @@ _get_commit_other_node(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path)
 
   CfgNode *cn = _create_commit_cfg_node(*cfg1, cur_path,
                                         COMMIT_STATE_UNCHANGED);
-  for (size_t i = 0; i < rcnodes1.size(); i++) {
-    CfgNode *cnode = getCommitTree(rcnodes1[i], rcnodes2[i],
-                                      cn->getCommitPath());
+  Cpath cpath = cn->getCommitPath();
+  CfgNode *c1, *c2;
+  for (size_t c = diff.firstChild(idx); c < diff.end(idx); c = diff.end(c)) {
+    if (!diff.getChild(c, cfg1, cfg2, c1, c2)) {
+      continue;
+    }
+    CfgNode *cnode = _get_commit_tree(diff, c, c1, c2, cpath);
     if (cnode) {
       cn->addChildNode(cnode);
     }
@@ -842,9 +1029,37 @@ _get_commit_other_node(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path)
   return cn;
 }
 
+static CfgNode *
+_get_commit_tree(const CfgDiff& diff, size_t idx, CfgNode *cfg1,
+                 CfgNode *cfg2, const Cpath& cur_path)
+{
+  // if doesn't exist or is deactivated, treat as NULL
+  if (cfg1 && (!cfg1->exists() || cfg1->isDeactivated()) ) {
+    cfg1 = NULL;
+  }
+  if (cfg2 && (!cfg2->exists() || cfg2->isDeactivated())) {
+    cfg2 = NULL;
+  }
+
+  if (!cfg1 && !cfg2) {
+    fprintf(stderr, "getCommitTree error (both config NULL)\n");
+    exit(1);
+  }
+
+  bool is_leaf = false;
+  CfgNode *cn = _get_commit_leaf_node(cfg1, cfg2, cur_path, is_leaf);
+  if (!is_leaf) {
+    // intermediate node, tag node, or tag value
+    cn = _get_commit_other_node(diff, idx, cfg1, cfg2, cur_path);
+  }
+  return cn;
+}
+
 static void
 _execute_hooks(CommitHook hook)
 {
+  TraceScope trace("commit", (hook == PRE_COMMIT ? "pre-commit hooks"
+                                                 : "post-commit hooks"));
   string cmd = "/bin/run-parts --regex='^[a-zA-Z0-9._-]+$' -- '";
   cmd += getCommitHookDir(hook);
   cmd += "'";
@@ -854,6 +1069,116 @@ _execute_hooks(CommitHook hook)
   redirect_output();
 }
 
+/* history of template action durations from commit trace files (see
+ * commit-trace.h). "action template" => (total usec, count).
+ */
+typedef MapT<string, pair<uint64_t, size_t> > PlanHistT;
+
+static string
+_get_plan_hist_key(const char *act, const string& tmpl)
+{
+  return (string(act) + " " + tmpl);
+}
+
+/* get the string value of "key" from a trace record. only handles the
+ * records written by the trace facility.
+ */
+static bool
+_get_trace_rec_str(const string& rec, const char *key, string& val)
+{
+  string k = string("\"") + key + "\":\"";
+  size_t p = rec.find(k);
+  if (p == rec.npos) {
+    return false;
+  }
+  val.clear();
+  for (p += k.length(); p < rec.length(); p++) {
+    char c = rec[p];
+    if (c == '"') {
+      return true;
+    }
+    if (c == '\\' && (p + 1) < rec.length()) {
+      c = rec[++p];
+      if (c == 'u' && (p + 4) < rec.length()) {
+        c = static_cast<char>(strtoul(rec.substr(p + 1, 4).c_str(), NULL,
+                                      16));
+        p += 4;
+      }
+    }
+    val += c;
+  }
+  return false;
+}
+
+static bool
+_load_plan_history(const string& file, PlanHistT& hist)
+{
+  ifstream fin(file.c_str());
+  if (!fin) {
+    return false;
+  }
+  string rec;
+  while (getline(fin, rec)) {
+    if (rec.find("\"cat\":\"action\"") == rec.npos) {
+      continue;
+    }
+    string name, tmpl;
+    size_t p = rec.find("\"dur\":");
+    if (!_get_trace_rec_str(rec, "name", name)
+        || !_get_trace_rec_str(rec, "tmpl", tmpl) || p == rec.npos) {
+      continue;
+    }
+    pair<uint64_t, size_t>& h = hist[_get_plan_hist_key(name.c_str(), tmpl)];
+    h.first += strtoull(rec.c_str() + p + 6, NULL, 10);
+    ++h.second;
+  }
+  return true;
+}
+
+// prio subtree in the commit plan. actions are [first, last) of the plan.
+struct PlanSubtree {
+  PrioNode *pnode;
+  bool is_delete;
+  size_t first;
+  size_t last;
+  uint64_t est;
+  PlanSubtree(PrioNode *p, bool d, size_t f)
+    : pnode(p), is_delete(d), first(f), last(f), est(0) {}
+};
+
+static bool
+_plan_subtree_slower(const PlanSubtree *a, const PlanSubtree *b)
+{
+  return (a->est > b->est);
+}
+
+static string
+_get_plan_time_str(uint64_t usec)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu.%03llu sec",
+           static_cast<unsigned long long>(usec / 1000000),
+           static_cast<unsigned long long>((usec % 1000000) / 1000));
+  return buf;
+}
+
+// collect the plan of the prio subtrees in queue "q" (in commit order)
+template<class QueueT> static void
+_get_commit_plan(Cstore& cs, QueueT& q, bool is_delete,
+                 vector<PlanSubtree>& subtrees)
+{
+  while (!q.empty()) {
+    PrioNode *p = q.top();
+    q.pop();
+    PlanSubtree st(p, is_delete, commit_plan->size());
+    _commit_exec_prio_subtree(cs, p);
+    st.last = commit_plan->size();
+    if (st.last > st.first) {
+      subtrees.push_back(st);
+    }
+  }
+}
+
 
 ////// class CommitData
 CommitData::CommitData()
@@ -1061,6 +1386,13 @@ PrioNode::getCommitPath() const
   return (_node ? _node->getCommitPath() : Cpath());
 }
 
+const string&
+PrioNode::getIndexKey() const
+{
+  static const string empty;
+  return (_node ? _node->getIndexKey() : empty);
+}
+
 bool
 PrioNode::parentCreateFailed() const
 {
@@ -1167,26 +1499,14 @@ commit::getCommitHookDir(CommitHook hook)
 CfgNode *
 commit::getCommitTree(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path)
 {
-  // if doesn't exist or is deactivated, treat as NULL
-  if (cfg1 && (!cfg1->exists() || cfg1->isDeactivated()) ) {
-    cfg1 = NULL;
-  }
-  if (cfg2 && (!cfg2->exists() || cfg2->isDeactivated())) {
-    cfg2 = NULL;
-  }
-
-  if (!cfg1 && !cfg2) {
-    fprintf(stderr, "getCommitTree error (both config NULL)\n");
-    exit(1);
-  }
+  CfgDiff diff(*cfg1, *cfg2);
+  return getCommitTree(diff, cur_path);
+}
 
-  bool is_leaf = false;
-  CfgNode *cn = _get_commit_leaf_node(cfg1, cfg2, cur_path, is_leaf);
-  if (!is_leaf) {
-    // intermediate node, tag node, or tag value
-    cn = _get_commit_other_node(cfg1, cfg2, cur_path);
-  }
-  return cn;
+CfgNode *
+commit::getCommitTree(const CfgDiff& diff, const Cpath& cur_path)
+{
+  return _get_commit_tree(diff, 0, diff.cfg1(0), diff.cfg2(0), cur_path);
 }
 
 bool
@@ -1250,6 +1570,140 @@ commit::isCommitPathEffective(Cstore& cs, const Cpath& pcomps,
   return (in_active ? !marked : marked);
 }
 
+/* execute the commit of commit tree "root" in priority order. "proot" is
+ * the (empty) prio node corresponding to "root", and it records the
+ * outcome upon return. "s" and "f" are the numbers of prio subtrees that
+ * succeeded/failed.
+ */
+static void
+_commit_exec_prio_tree(Cstore& cs, CfgNode *root, PrioNode& proot,
+                       size_t& s, size_t& f)
+{
+  PrioQueueT pq;
+  DelPrioQueueT dpq;
+  {
+    TraceScope trace("commit", "prio queue");
+    _get_commit_prio_subtrees(root, proot);
+    // at this point all prio nodes have been detached from root
+    _get_commit_prio_queue(&proot, pq, dpq);
+  }
+  TraceScope trace("commit", "exec prio tree");
+
+  debug_on = !!getenv("VYOS_DEBUG");
+  TRACE_INIT("Processing the Priority Queue");
+  clear_last();
+  int num = pq.size();
+  // decrease by one because we have one root element
+  --num;
+  size_t jobs = _get_commit_parallel_jobs();
+  vector<PrioNode *> batch;
+  vector<bool> results;
+  // all deletions first
+  while (!dpq.empty()) {
+    size_t remaining = num + dpq.size();
+    _get_commit_prio_batch(dpq, batch);
+    _commit_exec_prio_batch(cs, batch, jobs, remaining, results);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!results[i]) {
+        // prio subtree failed
+        OUTPUT_USER("delete [ %s ] failed\n", 
+                    batch[i]->getCommitPath().to_string().c_str());
+        ++f;
+      } else {
+        // succeeded
+        ++s;
+      }
+    }
+  }
+  while (!pq.empty()) {
+    size_t remaining = pq.size();
+    _get_commit_prio_batch(pq, batch);
+    _commit_exec_prio_batch(cs, batch, jobs, remaining, results);
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (!results[i]) {
+        // prio subtree failed
+        OUTPUT_USER("[[%s]] failed\n",
+                    batch[i]->getCommitPath().to_string().c_str());
+        ++f;
+      } else {
+        // succeeded
+        ++s;
+      }
+    }
+  }
+  TRACE_DISPLAY("Commit execute priority tree");
+}
+
+/* execute the commit tree "root" and install the result as the active
+ * config. this is the common part of doCommit() and doBootCommit(). "boot"
+ * specifies the latter (see Cstore::commitBootConfig()).
+ */
+static bool
+_commit_exec_and_install(Cstore& cs, CfgNode *root, bool boot)
+{
+  _execute_hooks(PRE_COMMIT);
+  set_in_commit(true);
+  set_pure_eval_scope(true);
+
+  /* working and active configs don't change while the actions are
+   * executed, so effectiveness and var refs can be memoized until then.
+   */
+  PrioNode proot(root); // proot corresponds to root
+  size_t s = 0, f = 0;
+  cs.setEffectiveCache(true);
+  cs.setVarRefCache(true);
+  _commit_exec_prio_tree(cs, root, proot, s, f);
+  cs.setVarRefCache(false);
+  cs.setEffectiveCache(false);
+  bool ret = true;
+  const char *cst = "SUCCESS";
+  if (f > 0) {
+    OUTPUT_USER("Commit failed\n");
+    ret = false;
+    cst = ((s > 0) ? "PARTIAL" : "FAILURE");
+  }
+
+  if (s > 0 && !boot) {
+    // notify other users in config mode
+    TraceScope ntrace("commit", "notify");
+    if(system("/opt/vyatta/sbin/vyatta-cfg-notify"));
+  }
+
+  bool committed = false;
+  if (boot) {
+    TraceScope ctrace("commit", "commitBootConfig");
+    committed = cs.commitBootConfig(proot);
+  } else {
+    TraceScope ctrace("commit", "commitConfig");
+    committed = cs.commitConfig(proot);
+  }
+  if (!committed) {
+    OUTPUT_USER("Failed to generate committed config\n");
+    ret = false;
+  }
+
+  set_in_commit(false);
+  set_pure_eval_scope(false);
+  if (!cs.clearCommittedMarkers()) {
+    OUTPUT_USER("Failed to clear committed markers\n");
+    ret = false;
+  }
+  if (ret && !boot) {
+    ret = cs.markSessionUnsaved();
+  }
+
+  {
+    TraceScope strace("commit", "sync");
+    sync();
+  }
+
+  setenv("COMMIT_STATUS", cst, 1);
+  _execute_hooks(POST_COMMIT);
+  unsetenv("COMMIT_STATUS");
+
+  return ret;
+}
+
 bool
 commit::doCommit(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2)
 {
@@ -1265,8 +1719,13 @@ commit::doCommit(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2)
     return false;
   }
 
+  TraceScope trace("commit", "commit");
   Cpath p;
-  CfgNode *root = getCommitTree(&cfg1, &cfg2, p);
+  CfgNode *root = NULL;
+  {
+    TraceScope gtrace("commit", "getCommitTree");
+    root = getCommitTree(&cfg1, &cfg2, p);
+  }
   if (!root) {
     /* "session changed" check has already been performed before commit
      * execution, so no need to repeat it here.
@@ -1293,85 +1752,176 @@ commit::doCommit(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2)
     return true;
   }
 
-  _execute_hooks(PRE_COMMIT);
-  set_in_commit(true);
+  return _commit_exec_and_install(cs, root, false);
+}
+
+/* boot-time commit of working config "cfg" (see Cstore::bootLoadFile()).
+ * the active config is empty at boot, so everything in "cfg" is added,
+ * and the committed config is installed directly as the active config
+ * (see Cstore::commitBootConfig()) instead of going through the session.
+ */
+bool
+commit::doBootCommit(Cstore& cs, CfgNode& cfg)
+{
+  if (!cs.getCommitLock()) {
+    OUTPUT_USER("Configuration system temporarily locked "
+                "due to another commit in progress\n");
+    return false;
+  }
+
+  TraceScope trace("commit", "boot commit");
+  Cpath p;
+  CfgNode aroot(p, NULL, NULL, NULL, 0, &cs, false);
+  CfgNode *root = NULL;
+  {
+    TraceScope gtrace("commit", "getCommitTree");
+    root = getCommitTree(&aroot, &cfg, p);
+  }
+  if (!root) {
+    // empty config. just install it.
+    PrioNode pn(&aroot);
+    pn.setSucceeded(true);
+    if (!cs.commitBootConfig(pn)) {
+      OUTPUT_USER("Failed to generate committed config\n");
+      return false;
+    }
+    return true;
+  }
+
+  return _commit_exec_and_install(cs, root, true);
+}
+
+/* show the "commit plan" of committing the changes from "cfg1" to "cfg2",
+ * i.e., the prio subtrees in commit order and the template actions that
+ * would be executed for each, without executing anything. this assumes
+ * all actions succeed.
+ *
+ * "hist_files" are commit trace files (see commit-trace.h) of earlier
+ * commits. if specified, the average duration of the same action on the
+ * same template in them is used to estimate the time of each action.
+ */
+bool
+commit::showCommitPlan(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2,
+                       const vector<string>& hist_files)
+{
+  /* the dry run goes through the same code as commit, which must not
+   * start (i.e., truncate) the trace file.
+   */
+  commit_trace_disable();
+
+  PlanHistT hist;
+  for (size_t i = 0; i < hist_files.size(); i++) {
+    if (!_load_plan_history(hist_files[i], hist)) {
+      printf("Cannot read commit trace file [%s]\n", hist_files[i].c_str());
+      return false;
+    }
+  }
+
+  Cpath p;
+  CfgNode *root = getCommitTree(&cfg1, &cfg2, p);
+  if (!root) {
+    printf("No configuration changes to commit\n");
+    return true;
+  }
 
   PrioNode proot(root); // proot corresponds to root
   _get_commit_prio_subtrees(root, proot);
-  // at this point all prio nodes have been detached from root
   PrioQueueT pq;
   DelPrioQueueT dpq;
   _get_commit_prio_queue(&proot, pq, dpq);
-  size_t s = 0, f = 0;
 
-  debug_on = !!getenv("VYOS_DEBUG");
-  TRACE_INIT("Processing the Priority Queue");
-  clear_last();
-  int num = pq.size();
-  // decrease by one because we have one root element
-  --num;
-  while (!dpq.empty()) {
-    PrioNode *p = dpq.top();
-    set_if_last(num+dpq.size());
-    if (!_commit_exec_prio_subtree(cs, p)) {
-      // prio subtree failed
-      OUTPUT_USER("delete [ %s ] failed\n", 
-		  p->getCommitPath().to_string().c_str());
-      ++f;
-    } else {
-      // succeeded
-      ++s;
+  vector<PlanAction> plan;
+  vector<PlanSubtree> subtrees;
+  commit_plan = &plan;
+  // all deletions first
+  _get_commit_plan(cs, dpq, true, subtrees);
+  _get_commit_plan(cs, pq, false, subtrees);
+  commit_plan = NULL;
+
+  // estimate
+  vector<uint64_t> est(plan.size(), 0);
+  vector<bool> has_est(plan.size(), false);
+  size_t num_est = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < plan.size(); i++) {
+    PlanHistT::iterator it
+      = hist.find(_get_plan_hist_key(act_type_to_name(plan[i].act),
+                                     plan[i].tmpl));
+    if (it != hist.end()) {
+      est[i] = it->second.first / it->second.second;
+      has_est[i] = true;
+      ++num_est;
     }
-    dpq.pop();
   }
-  while (!pq.empty()) {
-    PrioNode *p = pq.top();
-    set_if_last(pq.size());
-    if (!_commit_exec_prio_subtree(cs, p)) {
-      // prio subtree failed
-      OUTPUT_USER("[[%s]] failed\n",
-		  p->getCommitPath().to_string().c_str());
-      ++f;
-    } else {
-      // succeeded
-      ++s;
+  for (size_t i = 0; i < subtrees.size(); i++) {
+    for (size_t j = subtrees[i].first; j < subtrees[i].last; j++) {
+      subtrees[i].est += est[j];
+    }
+    total += subtrees[i].est;
+  }
+
+  printf("Commit plan: %u priority subtrees, %u actions\n",
+         static_cast<unsigned int>(subtrees.size()),
+         static_cast<unsigned int>(plan.size()));
+  for (size_t i = 0; i < subtrees.size(); i++) {
+    const PlanSubtree& st = subtrees[i];
+    string path = st.pnode->getCommitPath().to_string();
+    printf("\n[%u] %s priority %u: %s", static_cast<unsigned int>(i + 1),
+           (st.is_delete ? "delete" : "set"), st.pnode->getPriority(),
+           (path.empty() ? "(root)" : path.c_str()));
+    if (num_est > 0) {
+      printf(" (%s)", _get_plan_time_str(st.est).c_str());
+    }
+    printf("\n");
+    for (size_t j = st.first; j < st.last; j++) {
+      printf("    %-8s %s", act_type_to_name(plan[j].act),
+             plan[j].disp.c_str());
+      if (num_est > 0) {
+        printf(" (%s)", (has_est[j] ? _get_plan_time_str(est[j]).c_str()
+                                    : "?"));
+      }
+      printf("\n");
     }
-    pq.pop();
-  }
-  TRACE_DISPLAY("Commit execute priority tree");
-  bool ret = true;
-  const char *cst = "SUCCESS";
-  if (f > 0) {
-    OUTPUT_USER("Commit failed\n");
-    ret = false;
-    cst = ((s > 0) ? "PARTIAL" : "FAILURE");
   }
 
-  if (s > 0) {
-    // notify other users in config mode
-    if(system("/opt/vyatta/sbin/vyatta-cfg-notify"));
+  size_t counts[top_act];
+  for (size_t i = 0; i < top_act; i++) {
+    counts[i] = 0;
   }
-
-  if (!cs.commitConfig(proot)) {
-    OUTPUT_USER("Failed to generate committed config\n");
-    ret = false;
+  for (size_t i = 0; i < plan.size(); i++) {
+    ++counts[plan[i].act];
   }
-
-  set_in_commit(false);
-  if (!cs.clearCommittedMarkers()) {
-    OUTPUT_USER("Failed to clear committed markers\n");
-    ret = false;
+  printf("\nActions:");
+  for (size_t i = 0; i < top_act; i++) {
+    if (counts[i] > 0) {
+      printf(" %s %u", act_type_to_name(static_cast<vtw_act_type>(i)),
+             static_cast<unsigned int>(counts[i]));
+    }
   }
-  if (ret) {
-    ret = cs.markSessionUnsaved();
+  printf("\n");
+
+  if (hist_files.size() > 0) {
+    printf("Estimated time: %s (%u of %u actions in history)\n",
+           _get_plan_time_str(total).c_str(),
+           static_cast<unsigned int>(num_est),
+           static_cast<unsigned int>(plan.size()));
+    vector<const PlanSubtree *> slowest;
+    for (size_t i = 0; i < subtrees.size(); i++) {
+      if (subtrees[i].est > 0) {
+        slowest.push_back(&(subtrees[i]));
+      }
+    }
+    stable_sort(slowest.begin(), slowest.end(), _plan_subtree_slower);
+    if (slowest.size() > 5) {
+      slowest.resize(5);
+    }
+    if (slowest.size() > 0) {
+      printf("Slowest priority subtrees:\n");
+    }
+    for (size_t i = 0; i < slowest.size(); i++) {
+      printf("  %s  [%u]\n", _get_plan_time_str(slowest[i]->est).c_str(),
+             static_cast<unsigned int>(slowest[i] - &(subtrees[0]) + 1));
+    }
   }
-
-  sync();
-
-  setenv("COMMIT_STATUS", cst, 1);
-  _execute_hooks(POST_COMMIT);
-  unsetenv("COMMIT_STATUS");
-
-  return ret;
+  return true;
 }
-
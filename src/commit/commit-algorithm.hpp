@@ -28,6 +28,7 @@
 // forward decl
 namespace cnode {
 class CfgNode;
+class CfgDiff;
 }
 namespace cstore {
 class Cstore;
@@ -116,6 +117,7 @@ public:
   unsigned int getPriority() const;
   CommitState getCommitState() const;
   Cpath getCommitPath() const;
+  const std::string& getIndexKey() const;
   bool parentCreateFailed() const;
   bool succeeded() const;
   bool hasSubtreeFailure() const;
@@ -163,10 +165,14 @@ typedef std::vector<CommittedPathT> CommittedPathListT;
 // exported functions
 const char *getCommitHookDir(CommitHook hook);
 CfgNode *getCommitTree(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path);
+CfgNode *getCommitTree(const CfgDiff& diff, const Cpath& cur_path);
 bool isCommitPathEffective(Cstore& cs, const Cpath& pcomps,
                            std::tr1::shared_ptr<Ctemplate> def,
                            bool in_active, bool in_working);
 bool doCommit(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2);
+bool doBootCommit(Cstore& cs, CfgNode& cfg);
+bool showCommitPlan(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2,
+                    const std::vector<std::string>& hist_files);
 
 } // namespace commit
 
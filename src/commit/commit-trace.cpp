@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <commit/commit-trace.h>
+
+using namespace std;
+
+/* fd of the trace file. -2 if not initialized yet, -1 if tracing is
+ * disabled. the fd is not passed to action processes.
+ */
+static int trace_fd = -2;
+
+/* set (to the trace file name) by the process that started the trace file,
+ * so that the processes it runs (e.g., action processes) append to the
+ * file instead of starting it over.
+ */
+static const char *C_ENV_COMMIT_TRACE_STARTED = "VYATTA_COMMIT_TRACE_STARTED";
+
+static bool
+_trace_enabled()
+{
+  if (trace_fd == -2) {
+    trace_fd = -1;
+    const char *fname = getenv(C_ENV_COMMIT_TRACE);
+    if (fname && fname[0]) {
+      const char *started = getenv(C_ENV_COMMIT_TRACE_STARTED);
+      bool top = (!started || strcmp(started, fname) != 0);
+      int fd = open(fname, (O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC
+                            | (top ? O_TRUNC : 0)), 0644);
+      if (fd >= 0) {
+        if (!top) {
+          trace_fd = fd;
+        } else if (write(fd, "[\n", 2) == 2) {
+          trace_fd = fd;
+          setenv(C_ENV_COMMIT_TRACE_STARTED, fname, 1);
+        } else {
+          close(fd);
+        }
+      }
+    }
+  }
+  return (trace_fd >= 0);
+}
+
+// in microseconds, as used by the format
+static uint64_t
+_trace_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000);
+}
+
+static void
+_trace_append_str(string& rec, const char *str)
+{
+  for (const char *c = str; *c; c++) {
+    unsigned char ch = *c;
+    if (ch == '"' || ch == '\\') {
+      rec += '\\';
+      rec += ch;
+    } else if (ch < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", ch);
+      rec += buf;
+    } else {
+      rec += ch;
+    }
+  }
+}
+
+uint64_t
+commit_trace_begin(void)
+{
+  return (_trace_enabled() ? _trace_now() : 0);
+}
+
+void
+commit_trace_end(uint64_t start, const char *cat, const char *name,
+                 const char *detail)
+{
+  commit_trace_end_tmpl(start, cat, name, detail, NULL);
+}
+
+void
+commit_trace_end_tmpl(uint64_t start, const char *cat, const char *name,
+                      const char *detail, const char *tmpl)
+{
+  if (start == 0 || trace_fd < 0) {
+    return;
+  }
+  uint64_t end = _trace_now();
+  unsigned int pid = getpid();
+  char buf[128];
+
+  string rec = "{\"name\":\"";
+  _trace_append_str(rec, name);
+  rec += "\",\"cat\":\"";
+  _trace_append_str(rec, cat);
+  snprintf(buf, sizeof(buf),
+           "\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u",
+           static_cast<unsigned long long>(start),
+           static_cast<unsigned long long>(end - start), pid, pid);
+  rec += buf;
+  bool has_detail = (detail && detail[0]);
+  bool has_tmpl = (tmpl && tmpl[0]);
+  if (has_detail || has_tmpl) {
+    rec += ",\"args\":{";
+    if (has_detail) {
+      rec += "\"detail\":\"";
+      _trace_append_str(rec, detail);
+      rec += "\"";
+    }
+    if (has_tmpl) {
+      rec += (has_detail ? ",\"tmpl\":\"" : "\"tmpl\":\"");
+      _trace_append_str(rec, tmpl);
+      rec += "\"";
+    }
+    rec += "}";
+  }
+  rec += "},\n";
+
+  /* a record is always a single write to the O_APPEND fd so that records
+   * from concurrent processes are not interleaved.
+   */
+  if (write(trace_fd, rec.data(), rec.length())
+      != static_cast<ssize_t>(rec.length())) {
+    // can't write. stop tracing.
+    close(trace_fd);
+    trace_fd = -1;
+  }
+}
+
+void
+commit_trace_disable(void)
+{
+  if (trace_fd >= 0) {
+    close(trace_fd);
+  }
+  trace_fd = -1;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COMMIT_TRACE_H_
+#define _COMMIT_TRACE_H_
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* commit timing trace.
+ *
+ * if the environment variable below is set to a file name, a record with
+ * the begin time and duration of each commit phase, prio subtree, template
+ * action, and action process is written to the file. the file uses the
+ * JSON array format of the "Trace Event Format" (one "complete" event per
+ * record), so it can be loaded directly into timeline viewers such as
+ * chrome://tracing and Perfetto.
+ *
+ * the file is truncated when the first record of a top-level process
+ * (e.g., the commit) is started. processes forked during commit (see
+ * parallel commit) and processes run by it (e.g., actions) append their
+ * records to the same file under their own pid, so the closing "]" of the
+ * array is left out (which the format allows).
+ */
+#define C_ENV_COMMIT_TRACE "VYATTA_COMMIT_TRACE"
+
+/* start a record and return its begin time, or 0 if tracing is disabled */
+uint64_t commit_trace_begin(void);
+
+/* finish the record that began at "start" (nop if 0). "cat" and "name"
+ * identify the record, and "detail" (if not NULL or empty) is shown in its
+ * arguments.
+ */
+void commit_trace_end(uint64_t start, const char *cat, const char *name,
+                      const char *detail);
+/* same as above, and also record the template path "tmpl" of the node (if
+ * not NULL or empty). this is used for template actions so that their
+ * durations can be used to estimate later commits (see showCommitPlan()).
+ */
+void commit_trace_end_tmpl(uint64_t start, const char *cat, const char *name,
+                           const char *detail, const char *tmpl);
+
+/* disable tracing for the rest of the process, e.g., for operations that
+ * are not an actual commit (see showCommitPlan()) and must not touch the
+ * trace file.
+ */
+void commit_trace_disable(void);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <cstore/cpath.hpp>
+
+namespace commit {
+
+// trace record covering the lifetime of the object
+class TraceScope {
+public:
+  TraceScope(const char *cat, const char *name)
+    : _start(commit_trace_begin()), _cat(cat), _name(name) {}
+  TraceScope(const char *cat, const char *name, const cstore::Cpath& path)
+    : _start(commit_trace_begin()), _cat(cat), _name(name) {
+    if (_start) {
+      _detail = path.to_string();
+    }
+  }
+  ~TraceScope() {
+    commit_trace_end_tmpl(_start, _cat, _name, _detail.c_str(),
+                          _tmpl.c_str());
+  }
+
+  bool enabled() const { return (_start != 0); }
+  void setTmpl(const std::string& tmpl) { _tmpl = tmpl; }
+
+private:
+  uint64_t _start;
+  const char *_cat;
+  const char *_name;
+  std::string _detail;
+  std::string _tmpl;
+
+  // not copyable
+  TraceScope(const TraceScope&);
+  TraceScope& operator=(const TraceScope&);
+};
+
+} // namespace commit
+#endif
+
+#endif /* _COMMIT_TRACE_H_ */
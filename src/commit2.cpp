@@ -39,17 +39,12 @@ const int ActionOrder[g_num_actions] = {
   end_act
 };
 
-// this corresponds to the vtw_act_type enum
-static const char* ActionNames[top_act] = {
-  "delete",   //0
-  "create",   //1
-  "activate", //2
-  "update",   //3
-  "syntax",   //4
-  "commit",   //5
-  "begin",    //6
-  "end"       //7
-};
+// see act_type_to_name()
+static inline const char*
+action_name(int act)
+{
+  return act_type_to_name((vtw_act_type) act);
+}
 
 GNode*
 get_transactions(GNode*, boolean priority);
@@ -606,14 +601,14 @@ process_func(GNode *node, gpointer data)
       }
       
       common_set_context(c->_path,d->_path);
-      d_dplog("Executing %s on this node", ActionNames[result->_action]);
+      d_dplog("Executing %s on this node", action_name(result->_action));
 
       if (g_coverage) {
         struct timeval t;
         gettimeofday(&t,NULL);
         fprintf(out_stream, "[START] %lu:%lu, %s@%s",
                 (unsigned long) t.tv_sec, (unsigned long) t.tv_usec,
-                ActionNames[result->_action], d->_path);
+                action_name(result->_action), d->_path);
       }
 
       if (result->_action == delete_act) {
@@ -662,7 +657,7 @@ process_func(GNode *node, gpointer data)
         }
       } else {
         char buf[MAX_LENGTH_DIR_PATH*sizeof(char)];
-        sprintf(buf,"%s\t:\t%s",ActionNames[result->_action],d->_path);
+        sprintf(buf,"%s\t:\t%s",action_name(result->_action),d->_path);
         if (c->_def.multi) {
           /* need to handle the embedded multinode as a special
            * case--should be fixed!
@@ -690,10 +685,10 @@ process_func(GNode *node, gpointer data)
 
       if (!status) { //EXECUTE_LIST RETURNS FALSE ON FAILURE....
         syslog(LOG_ERR, "commit error for %s:[%s]",
-               ActionNames[result->_action],d->_path);
+               action_name(result->_action),d->_path);
         if (g_display_error_node) {
           fprintf(out_stream, "%s@_errloc_:[%s]\n",
-                  ActionNames[result->_action], d->_path);
+                  action_name(result->_action), d->_path);
         }
         result->_err_code = 1;
         d_dplog("commit2::process_func(): FAILURE: status: %d", status);
@@ -1454,13 +1449,13 @@ validate_func(GNode *node, gpointer data)
   }
 
   common_set_context(c->_path,d->_path);
-  d_dplog("Executing %s on this node", ActionNames[result->_action]);
+  d_dplog("Executing %s on this node", action_name(result->_action));
   
   if (g_coverage) {
     struct timeval t;
     gettimeofday(&t,NULL);
     fprintf(out_stream, "[START] %lu:%lu, %s@%s", (unsigned long) t.tv_sec,
-            (unsigned long) t.tv_usec, ActionNames[result->_action], d->_path);
+            (unsigned long) t.tv_usec, action_name(result->_action), d->_path);
   }
 
   boolean status = 1;
@@ -1510,10 +1505,10 @@ validate_func(GNode *node, gpointer data)
   
   if (!status) { //EXECUTE_LIST RETURNS FALSE ON FAILURE....
     syslog(LOG_ERR, "commit error for %s:[%s]",
-           ActionNames[result->_action], d->_path);
+           action_name(result->_action), d->_path);
     if (g_display_error_node) {
       fprintf(out_stream, "%s@_errloc_:[%s]\n",
-              ActionNames[result->_action], d->_path);
+              action_name(result->_action), d->_path);
     }
     result->_err_code = 1;
     d_dplog("commit2::validate_func(): FAILURE: status: %d", status);
@@ -17,13 +17,123 @@
 #ifndef _CPARSE_HPP_
 #define _CPARSE_HPP_
 
+#include <cstdio>
+#include <vector>
+#include <string>
+
 #include <cstore/cstore.hpp>
 #include <cnode/cnode.hpp>
 
 namespace cparse {
 
+/* config parser. all parsing state is in the parser object, so multiple
+ * parsers can be used at the same time.
+ *
+ * the tree can be built either by parsing a config file (parse()) or by
+ * pushing nodes directly:
+ *
+ *   ConfigParser p(cstore);
+ *   p.addNode("interfaces", NULL, NULL, false);
+ *   p.goDown();
+ *   p.addNode("ethernet", "eth0", NULL, false);
+ *   p.goDown();
+ *   p.addNode("address", "1.1.1.1/24", NULL, false);
+ *   p.goUp();
+ *   p.goUp();
+ *   CfgNode *root = p.finish();
+ *
+ * each node's template is resolved relative to its parent's (already
+ * resolved) template, and resolved templates are shared among nodes with
+ * the same template (e.g., all values of a tag node), so the template
+ * store is only consulted once per distinct template node. existing nodes
+ * are found through their parent's child index.
+ */
+class ConfigParser {
+public:
+  ConfigParser(cstore::Cstore& cs);
+  ~ConfigParser();
+
+  /* add node "name" (with value "val" if not NULL) at the current level.
+   * if the node already exists, it becomes the current node (with the new
+   * value added/set, if any).
+   */
+  void addNode(const char *name, const char *val, const char *comment,
+               bool deact);
+  // move down into the current node. return false if there is none.
+  bool goDown();
+  // move up one level. return false if already at top level.
+  bool goUp();
+  /* finish and return the parsed tree (owned by the caller), or NULL if
+   * not at top level. the parser is reset in either case.
+   */
+  cnode::CfgNode *finish();
+
+  /* parse config file "fin" and return the parsed tree (owned by the
+   * caller), or NULL if parsing failed.
+   */
+  cnode::CfgNode *parse(FILE *fin);
+
+  /* only build the part of the tree along and under "filter". nodes off
+   * the filter path are skipped along with their subtrees (without
+   * resolving any templates), so the result only contains the ancestors
+   * of the node at "filter" and its subtree. an empty filter (the default)
+   * builds the whole tree.
+   */
+  void setFilter(const cstore::Cpath& filter) { _filter = filter; }
+
+private:
+  class TmplRef;
+
+  struct Level {
+    cnode::CfgNode *parent;
+    TmplRef *tref;
+    size_t ncomps;
+    Level(cnode::CfgNode *p, TmplRef *t, size_t n)
+      : parent(p), tref(t), ncomps(n) {}
+  };
+
+  cstore::Cstore& _cstore;
+  cnode::CfgNode *_root;
+  cnode::CfgNode *_cur_parent;
+  TmplRef *_cur_tref;
+  std::vector<Level> _levels;
+  cstore::Cpath _pcomps;
+
+  // last added node (see goDown())
+  cnode::CfgNode *_cur_node;
+  TmplRef *_cur_node_tref;
+  std::string _cur_name;
+  std::string _cur_val;
+  bool _cur_has_val;
+
+  // subtree filter (see setFilter())
+  cstore::Cpath _filter;
+  // number of levels into a skipped subtree
+  size_t _skip_depth;
+  // whether the last added node was skipped
+  bool _cur_skipped;
+
+  // resolved templates (all owned by _trefs)
+  TmplRef *_tmpl_root;
+  TmplRef *_tmpl_invalid;
+  std::vector<TmplRef *> _trefs;
+
+  void reset();
+  bool on_filter(const char *name, const char *val) const;
+  TmplRef *get_child_tref(TmplRef *tref, const char *comp);
+  cnode::CfgNode *new_node(TmplRef *tref, const char *name, const char *val,
+                           const char *comment, bool deact,
+                           bool tag_if_invalid = false);
+
+  // not copyable
+  ConfigParser(const ConfigParser&);
+  ConfigParser& operator=(const ConfigParser&);
+};
+
 cnode::CfgNode *parse_file(FILE *fin, cstore::Cstore& cs);
 cnode::CfgNode *parse_file(const char *fname, cstore::Cstore& cs);
+cnode::CfgNode *parse_file(const char *fname, cstore::Cstore& cs,
+                           const cstore::Cpath& filter);
 
 } // namespace cparse
 
@@ -132,6 +132,127 @@ cstore_cfg_path_get_effective_value(void *handle, const char *path_comps[],
   return NULL;
 }
 
+static void
+_get_rel_paths(const char **suffix_comps[], const int num_suffix_comps[],
+               int num_paths, vector<Cpath>& rel_paths)
+{
+  rel_paths.reserve(num_paths);
+  for (int i = 0; i < num_paths; i++) {
+    rel_paths.push_back(Cpath(suffix_comps[i], num_suffix_comps[i]));
+  }
+}
+
+static int
+_set_results(const vector<bool>& res, int results[])
+{
+  int num = 0;
+  for (size_t i = 0; i < res.size(); i++) {
+    results[i] = (res[i] ? 1 : 0);
+    num += results[i];
+  }
+  return num;
+}
+
+int
+cstore_cfg_paths_exist(void *handle, const char *base_comps[],
+                       int num_base_comps, const char **suffix_comps[],
+                       const int num_suffix_comps[], int num_paths,
+                       int results[])
+{
+  if (handle) {
+    Cpath base(base_comps, num_base_comps);
+    vector<Cpath> rel_paths;
+    _get_rel_paths(suffix_comps, num_suffix_comps, num_paths, rel_paths);
+    Cstore *cs = (Cstore *) handle;
+    vector<bool> res;
+    cs->cfgPathsExist(base, rel_paths, res);
+    return _set_results(res, results);
+  }
+  return 0;
+}
+
+int
+cstore_cfg_paths_exist_effective(void *handle, const char *base_comps[],
+                                 int num_base_comps,
+                                 const char **suffix_comps[],
+                                 const int num_suffix_comps[], int num_paths,
+                                 int results[])
+{
+  if (handle) {
+    Cpath base(base_comps, num_base_comps);
+    vector<Cpath> rel_paths;
+    _get_rel_paths(suffix_comps, num_suffix_comps, num_paths, rel_paths);
+    Cstore *cs = (Cstore *) handle;
+    vector<bool> res;
+    cs->cfgPathsEffective(base, rel_paths, res);
+    return _set_results(res, results);
+  }
+  return 0;
+}
+
+int
+cstore_cfg_paths_get_effective_value(void *handle, const char *base_comps[],
+                                     int num_base_comps,
+                                     const char **suffix_comps[],
+                                     const int num_suffix_comps[],
+                                     int num_paths, char *buf, int buf_len,
+                                     const char *vals[])
+{
+  if (!handle || buf_len < 0) {
+    return -1;
+  }
+  Cstore *cs = (Cstore *) handle;
+  Cpath p(base_comps, num_base_comps);
+  string val;
+  int used = 0;
+  for (int i = 0; i < num_paths; i++) {
+    vals[i] = NULL;
+    for (int j = 0; j < num_suffix_comps[i]; j++) {
+      p.push(suffix_comps[i][j]);
+    }
+    if (cs->cfgPathGetEffectiveValue(p, val)) {
+      int vsize = val.length() + 1;
+      if (vsize <= buf_len - used) {
+        memcpy(buf + used, val.c_str(), vsize);
+        vals[i] = buf + used;
+      }
+      used += vsize;
+    }
+    for (int j = 0; j < num_suffix_comps[i]; j++) {
+      p.pop();
+    }
+  }
+  return used;
+}
+
+struct ChildFuncArg {
+  int (*func)(const char *name, void *arg);
+  void *arg;
+};
+
+static bool
+_call_child_func(const char *name, void *arg)
+{
+  ChildFuncArg *a = static_cast<ChildFuncArg *>(arg);
+  return (a->func(name, a->arg) != 0);
+}
+
+int
+cstore_cfg_path_for_each_child(void *handle, const char *path_comps[],
+                               int num_comps, int in_active,
+                               int (*func)(const char *name, void *arg),
+                               void *arg)
+{
+  if (handle && func) {
+    Cpath p(path_comps, num_comps);
+    Cstore *cs = (Cstore *) handle;
+    ChildFuncArg a = { func, arg };
+    cs->cfgPathForEachChildNode(p, _call_child_func, &a, in_active);
+    return 1;
+  }
+  return 0;
+}
+
 int
 cstore_unmark_cfg_path_changed(void *handle, const char *path_comps[],
                                int num_comps)
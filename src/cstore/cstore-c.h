@@ -37,6 +37,46 @@ char *cstore_cfg_path_get_effective_value(void *handle,
                                           const char *path_comps[],
                                           int num_comps);
 
+/* batch versions of the above for querying many paths under a common base
+ * path. the i-th path is the "base" path followed by the "num_suffix_comps[i]"
+ * components in "suffix_comps[i]". the base path is only resolved once.
+ *
+ * the "exist" functions set results[i] to 1 or 0 for the i-th path and
+ * return the number of paths that exist.
+ */
+int cstore_cfg_paths_exist(void *handle, const char *base_comps[],
+                           int num_base_comps, const char **suffix_comps[],
+                           const int num_suffix_comps[], int num_paths,
+                           int results[]);
+int cstore_cfg_paths_exist_effective(void *handle, const char *base_comps[],
+                                     int num_base_comps,
+                                     const char **suffix_comps[],
+                                     const int num_suffix_comps[],
+                                     int num_paths, int results[]);
+/* get the effective values of the paths into the caller's buffer "buf" of
+ * "buf_len" bytes. vals[i] is set to the NUL-terminated value of the i-th
+ * path in "buf", or NULL if it has no value or the value doesn't fit.
+ * return the number of bytes needed for all the values (i.e., everything
+ * fits if the return value is not more than "buf_len"), or -1 on error.
+ */
+int cstore_cfg_paths_get_effective_value(void *handle,
+                                         const char *base_comps[],
+                                         int num_base_comps,
+                                         const char **suffix_comps[],
+                                         const int num_suffix_comps[],
+                                         int num_paths, char *buf,
+                                         int buf_len, const char *vals[]);
+
+/* call "func" with the name of each child node of the path in working
+ * config (or active config if "in_active") until it returns 0. the name is
+ * only valid during the call, and the order is not defined. return 1 if
+ * successful. otherwise return 0.
+ */
+int cstore_cfg_path_for_each_child(void *handle, const char *path_comps[],
+                                   int num_comps, int in_active,
+                                   int (*func)(const char *name, void *arg),
+                                   void *arg);
+
 int cstore_unmark_cfg_path_changed(void *handle, const char *path_comps[],
                                    int num_comps);
 
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <tr1/functional>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstore/cstore-comp-cache.hpp>
+
+using namespace cstore;
+using namespace std;
+
+const char *CompCache::C_ENV_TTL = "VYATTA_COMP_CACHE_TTL";
+const char *CompCache::C_GEN_FILE = ".gen";
+const char *CompCache::C_CONST_GEN = "-";
+
+////// file helpers
+static bool
+_read_file(const string& file, string& data, time_t *mtime)
+{
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  if (mtime) {
+    *mtime = st.st_mtime;
+  }
+  data.clear();
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return false;
+    }
+    data.append(buf, n);
+  }
+  close(fd);
+  return true;
+}
+
+// write "data" into a new temporary file next to "file"
+static bool
+_write_tmp_file(const string& file, const string& data, string& tmp_file)
+{
+  char pid_str[16];
+  snprintf(pid_str, sizeof(pid_str), "%u", getpid());
+  tmp_file = file + ".tmp." + pid_str;
+  int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  size_t off = 0;
+  while (off < data.length()) {
+    ssize_t n = write(fd, data.data() + off, data.length() - off);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    off += n;
+  }
+  if (close(fd) != 0 || off < data.length()) {
+    unlink(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+static void
+_make_dir(const string& dir)
+{
+  // the parent is the session's temporary directory, which may be gone
+  size_t pos = dir.rfind('/');
+  if (pos != dir.npos && pos > 0) {
+    mkdir(dir.substr(0, pos).c_str(), 0755);
+  }
+  mkdir(dir.c_str(), 0755);
+}
+
+////// constructors/destructors
+CompCache::CompCache(const string& dir)
+  : _dir(dir), _ttl(C_DEF_TTL)
+{
+  const char *tstr = getenv(C_ENV_TTL);
+  if (tstr && tstr[0]) {
+    char *end = NULL;
+    unsigned long t = strtoul(tstr, &end, 10);
+    if (*end == 0) {
+      _ttl = t;
+    }
+  }
+}
+
+////// public functions
+string
+CompCache::getGen(bool config_dep)
+{
+  if (!enabled()) {
+    return "";
+  }
+  if (!config_dep) {
+    return C_CONST_GEN;
+  }
+  string gen;
+  if (read_gen(gen)) {
+    return gen;
+  }
+
+  // start a new generation
+  _make_dir(_dir);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%ld.%09ld.%u", static_cast<long>(ts.tv_sec),
+           static_cast<long>(ts.tv_nsec), getpid());
+  string gfile = _dir + "/" + C_GEN_FILE;
+  string tmp_file;
+  if (!_write_tmp_file(gfile, buf, tmp_file)) {
+    return "";
+  }
+  /* link() only succeeds if the file doesn't exist. if another process got
+   * there first, use its generation.
+   */
+  bool created = (link(tmp_file.c_str(), gfile.c_str()) == 0);
+  unlink(tmp_file.c_str());
+  if (created) {
+    return buf;
+  }
+  return (read_gen(gen) ? gen : "");
+}
+
+CompCache::StatusT
+CompCache::get(const string& key, bool config_dep, string& data,
+               unsigned int& run_ms)
+{
+  if (!enabled()) {
+    return MISS;
+  }
+  string gen = C_CONST_GEN;
+  if (config_dep && !read_gen(gen)) {
+    // no generation => nothing is valid
+    return MISS;
+  }
+
+  string content;
+  time_t mtime;
+  if (!_read_file(entry_file(key), content, &mtime)) {
+    return MISS;
+  }
+  // header: generation, run time, key length. then key and data.
+  size_t p1 = content.find('\n');
+  size_t p2 = (p1 == content.npos ? p1 : content.find('\n', p1 + 1));
+  size_t p3 = (p2 == content.npos ? p2 : content.find('\n', p2 + 1));
+  if (p3 == content.npos || content.compare(0, p1, gen) != 0) {
+    return MISS;
+  }
+  unsigned int ms = strtoul(content.c_str() + p1 + 1, NULL, 10);
+  size_t klen = strtoul(content.c_str() + p2 + 1, NULL, 10);
+  size_t kstart = p3 + 1;
+  if (content.length() - kstart < klen
+      || content.compare(kstart, klen, key) != 0) {
+    // hash collision
+    return MISS;
+  }
+
+  time_t now = time(NULL);
+  unsigned long age = (now > mtime ? now - mtime : 0);
+  if (age >= static_cast<unsigned long>(_ttl) * C_MAX_STALE_FACTOR) {
+    return MISS;
+  }
+  data = content.substr(kstart + klen);
+  run_ms = ms;
+  return (age < _ttl ? FRESH : STALE);
+}
+
+void
+CompCache::put(const string& key, const string& gen, const string& data,
+               unsigned int run_ms)
+{
+  if (!enabled() || gen.empty()) {
+    return;
+  }
+  if (gen == C_CONST_GEN) {
+    _make_dir(_dir);
+  } else {
+    string cur;
+    if (!read_gen(cur) || cur != gen) {
+      // invalidated while getting the data
+      return;
+    }
+  }
+
+  char buf[64];
+  snprintf(buf, sizeof(buf), "\n%u\n%zu\n", run_ms, key.length());
+  string content = gen + buf + key + data;
+  string file = entry_file(key);
+  string tmp_file;
+  if (_write_tmp_file(file, content, tmp_file)
+      && rename(tmp_file.c_str(), file.c_str()) != 0) {
+    unlink(tmp_file.c_str());
+  }
+}
+
+bool
+CompCache::lockRefresh(const string& key)
+{
+  string lfile = entry_file(key) + ".lock";
+  for (int i = 0; i < 2; i++) {
+    int fd = open(lfile.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0) {
+      close(fd);
+      return true;
+    }
+    struct stat st;
+    if (errno != EEXIST || stat(lfile.c_str(), &st) != 0
+        || time(NULL) - st.st_mtime < C_REFRESH_TIMEOUT) {
+      return false;
+    }
+    // the refreshing process must have died. take over.
+    unlink(lfile.c_str());
+  }
+  return false;
+}
+
+void
+CompCache::unlockRefresh(const string& key)
+{
+  unlink((entry_file(key) + ".lock").c_str());
+}
+
+void
+CompCache::invalidate(const string& dir)
+{
+  unlink((dir + "/" + C_GEN_FILE).c_str());
+}
+
+////// private functions
+string
+CompCache::entry_file(const string& key)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%zx", tr1::hash<string>()(key));
+  return (_dir + "/" + buf);
+}
+
+bool
+CompCache::read_gen(string& gen)
+{
+  return (_read_file(_dir + "/" + C_GEN_FILE, gen, NULL) && !gen.empty());
+}
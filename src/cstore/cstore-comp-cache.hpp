@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSTORE_COMP_CACHE_HPP_
+#define _CSTORE_COMP_CACHE_HPP_
+#include <string>
+
+namespace cstore { // begin namespace cstore
+
+/* cache of completion results (see Cstore::getCompletionEnv()) shared by
+ * all completions in a config session. each entry is a file in the cache
+ * directory of the session.
+ *
+ * invalidation rules:
+ *   * an entry is "fresh" for the TTL (in seconds) given by the environment
+ *     variable below (default C_DEF_TTL, 0 disables the cache). after that
+ *     it is "stale" until C_MAX_STALE_FACTOR times the TTL, and then it is
+ *     not used any more.
+ *   * an entry that depends on the config (e.g., output of "allowed"
+ *     scripts, which may refer to config nodes) is only valid for the
+ *     "generation" of the session it was created in. the generation is
+ *     changed by invalidate() whenever the working config of the session
+ *     is modified and when the session commits (which changes the active
+ *     config).
+ */
+class CompCache {
+public:
+  static const char *C_ENV_TTL;
+  static const unsigned int C_DEF_TTL = 30;
+  static const unsigned int C_MAX_STALE_FACTOR = 10;
+  /* a stale entry whose data took at least this long (in milliseconds) to
+   * get is still used, and it is refreshed in the background.
+   */
+  static const unsigned int C_SLOW_MS = 200;
+
+  enum StatusT {
+    MISS,
+    FRESH,
+    STALE
+  };
+
+  CompCache(const std::string& dir);
+  ~CompCache() {};
+
+  bool enabled() const { return (_ttl > 0); };
+
+  /* return the current generation of the session, or "" if it's not
+   * available (in which case nothing should be cached). an entry that
+   * doesn't depend on the config uses a fixed generation instead.
+   */
+  std::string getGen(bool config_dep);
+
+  /* look up "key". "data" and "run_ms" (how long it took to get the data)
+   * are set if the result is not MISS.
+   */
+  StatusT get(const std::string& key, bool config_dep, std::string& data,
+              unsigned int& run_ms);
+  /* store the data for "key" obtained in generation "gen" (see getGen()).
+   * nop if the generation has changed in the meantime.
+   */
+  void put(const std::string& key, const std::string& gen,
+           const std::string& data, unsigned int run_ms);
+
+  /* make sure only one process refreshes a stale entry. return false if
+   * it's already being refreshed.
+   */
+  bool lockRefresh(const std::string& key);
+  void unlockRefresh(const std::string& key);
+
+  // change the generation of the cache in "dir"
+  static void invalidate(const std::string& dir);
+
+private:
+  static const char *C_GEN_FILE;
+  static const char *C_CONST_GEN;
+  static const unsigned int C_REFRESH_TIMEOUT = 300;
+
+  std::string _dir;
+  unsigned int _ttl;
+
+  std::string entry_file(const std::string& key);
+  bool read_gen(std::string& gen);
+};
+
+} // end namespace cstore
+
+#endif /* _CSTORE_COMP_CACHE_HPP_ */
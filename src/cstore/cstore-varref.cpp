@@ -212,7 +212,7 @@ Cstore::VarRef::process_ref(const Cpath& ref_comps,
     if (def->isMulti()) {
       // multi-value node
       vector<string> vals;
-      if (!_cstore->cfgPathGetValues(pcomps, vals, _active)) {
+      if (!get_values(pcomps, vals)) {
         return;
       }
       string val;
@@ -230,7 +230,7 @@ Cstore::VarRef::process_ref(const Cpath& ref_comps,
       // single-value node
       string val;
       vtw_type_e t = def->getType(1);
-      if (!_cstore->cfgPathGetValue(pcomps, val, _active)) {
+      if (!get_value(pcomps, val)) {
         /* can't get value => treat it as non-existent (empty value
          * and type ERROR_TYPE)
          */
@@ -244,6 +244,55 @@ Cstore::VarRef::process_ref(const Cpath& ref_comps,
   }
 }
 
+// config lookups. these use the cstore's var ref cache if it is enabled.
+bool
+Cstore::VarRef::path_exists(const Cpath& path_comps)
+{
+  if (!_cstore->_vref_cache) {
+    return _cstore->cfgPathExists(path_comps, _active);
+  }
+  VarRefCache::Entry& e = _cstore->_vref_cache->get(path_comps, _active);
+  if (!e.has_exists) {
+    e.exists = _cstore->cfgPathExists(path_comps, _active);
+    e.has_exists = true;
+  }
+  return e.exists;
+}
+
+bool
+Cstore::VarRef::get_value(const Cpath& path_comps, string& value)
+{
+  if (!_cstore->_vref_cache) {
+    return _cstore->cfgPathGetValue(path_comps, value, _active);
+  }
+  VarRefCache::Entry& e = _cstore->_vref_cache->get(path_comps, _active);
+  if (!e.has_value) {
+    e.value_ok = _cstore->cfgPathGetValue(path_comps, e.value, _active);
+    e.has_value = true;
+  }
+  if (e.value_ok) {
+    value = e.value;
+  }
+  return e.value_ok;
+}
+
+bool
+Cstore::VarRef::get_values(const Cpath& path_comps, vector<string>& values)
+{
+  if (!_cstore->_vref_cache) {
+    return _cstore->cfgPathGetValues(path_comps, values, _active);
+  }
+  VarRefCache::Entry& e = _cstore->_vref_cache->get(path_comps, _active);
+  if (!e.has_values) {
+    e.values_ok = _cstore->cfgPathGetValues(path_comps, e.values, _active);
+    e.has_values = true;
+  }
+  if (e.values_ok) {
+    values.insert(values.end(), e.values.begin(), e.values.end());
+  }
+  return e.values_ok;
+}
+
 bool
 Cstore::VarRef::getValue(string& value, vtw_type_e& def_type)
 {
@@ -259,8 +308,7 @@ Cstore::VarRef::getValue(string& value, vtw_type_e& def_type)
       // already added
       continue;
     }
-    if (_paths[i].second == ERROR_TYPE
-        && !_cstore->cfgPathExists(_paths[i].first, _active)) {
+    if (_paths[i].second == ERROR_TYPE && !path_exists(_paths[i].first)) {
       // path doesn't exist => empty string
       added[""] = true;
       result.push_back("");
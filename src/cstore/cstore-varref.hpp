@@ -42,6 +42,43 @@ private:
 
   void process_ref(const Cpath& ref_comps,
                    const Cpath& cur_path_comps, vtw_type_e def_type);
+  bool path_exists(const Cpath& path_comps);
+  bool get_value(const Cpath& path_comps, string& value);
+  bool get_values(const Cpath& path_comps, vector<string>& values);
+};
+
+/* results of the config lookups for var refs, keyed on the resolved path
+ * and whether it is in active config. a lookup reads the node.val file and
+ * checks all ancestors for "deactivated", so references to the same nodes
+ * (e.g., in syntax checks of tag values) only do that once.
+ */
+class Cstore::VarRefCache {
+public:
+  struct Entry {
+    Entry() : has_exists(false), exists(false), has_value(false),
+              value_ok(false), has_values(false), values_ok(false) {};
+
+    bool has_exists;
+    bool exists;
+    bool has_value;
+    bool value_ok;
+    string value;
+    bool has_values;
+    bool values_ok;
+    vector<string> values;
+  };
+
+  Entry& get(const Cpath& path_comps, bool active) {
+    return (active ? _active : _work)[path_comps];
+  };
+  void clear() {
+    _active.clear();
+    _work.clear();
+  };
+
+private:
+  MapT<Cpath, Entry, CpathHash> _active;
+  MapT<Cpath, Entry, CpathHash> _work;
 };
 
 } // end namespace cstore
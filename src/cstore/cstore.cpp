@@ -22,6 +22,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
 #include <algorithm>
 #include <sstream>
 #include <memory>
@@ -33,10 +36,12 @@
 #include <cstore/cstore.hpp>
 #include <cstore/unionfs/cstore-unionfs.hpp>
 #include <cstore/cstore-varref.hpp>
+#include <cstore/cstore-comp-cache.hpp>
 #include <cnode/cnode.hpp>
 #include <cnode/cnode-algorithm.hpp>
 #include <cparse/cparse.hpp>
 #include <commit/commit-algorithm.hpp>
+#include <commit/commit-trace.h>
 
 namespace cstore { // begin namespace cstore
 
@@ -79,6 +84,45 @@ const unsigned int Cstore::SORT_NONE = 1;
 bool Cstore::_init = false;
 MapT<unsigned int, Cstore::SortFuncT> Cstore::_sort_func_map;
 
+////// member class
+/* state for applying a batch of changes (see loadFile()):
+ *   existing:  paths that are known to exist in working config.
+ *   validated: paths ending in a value that has been validated.
+ *   mark_path: path that is pending "changed" marking (see
+ *              mark_path_changed()).
+ */
+class Cstore::BatchState {
+public:
+  BatchState() : has_mark(false) {};
+
+  MapT<Cpath, bool, CpathHash> existing;
+  MapT<Cpath, bool, CpathHash> validated;
+  Cpath mark_path;
+  bool has_mark;
+};
+
+/* memoized effectiveness of paths (see setEffectiveCache()). the template
+ * of a path and whether it exists in working/active config are kept for
+ * the lifetime of the cache. the effectiveness also depends on the
+ * committed markers, so it is only reused while the markers are unchanged.
+ */
+class Cstore::EffectiveCache {
+public:
+  struct Entry {
+    Entry() : in_active(false), in_work(false), has_result(false),
+              markers_gen(0), effective(false) {};
+
+    tr1::shared_ptr<Ctemplate> def;
+    bool in_active;
+    bool in_work;
+    bool has_result;
+    unsigned long long markers_gen;
+    bool effective;
+  };
+
+  MapT<Cpath, Entry, CpathHash> entries;
+};
+
 
 ////// constructors/destructors
 /* this constructor just returns the generic environment string,
@@ -92,6 +136,7 @@ MapT<unsigned int, Cstore::SortFuncT> Cstore::_sort_func_map;
  *       this base class.
  */
 Cstore::Cstore(string& env)
+  : _batch(0), _eff_cache(0), _vref_cache(0)
 {
   init();
 
@@ -241,6 +286,26 @@ Cstore::tmplGetChildNodes(const Cpath& path_comps,
   sort_nodes(cnodes);
 }
 
+/* get the template path corresponding to specified path, i.e., the path
+ * with any tag values matched to the tag template, as a string.
+ *   tmpl_path: (output) template path.
+ * return true if successful. otherwise (path not valid) return false.
+ */
+bool
+Cstore::getTmplPathStr(const Cpath& path_comps, string& tmpl_path)
+{
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  if (!append_tmpl_path(path_comps)) {
+    return false;
+  }
+  tmpl_path = tmpl_path_to_str();
+  return true;
+}
+
 /* delete specified "logical path" from "working config".
  * return true if successful. otherwise return false.
  */
@@ -608,6 +673,108 @@ Cstore::getAllowedVarRef(string& astr){
   return;
 }
 
+// run command "cmd" for completion. return false if it fails.
+static bool
+_run_comp_cmd(const string& cmd, string& out, unsigned int& run_ms)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  char *buf = (char *) malloc(Cstore::MAX_CMD_OUTPUT_SIZE);
+  if (!buf) {
+    return false;
+  }
+  int ret = get_shell_command_output(cmd.c_str(), buf,
+                                     Cstore::MAX_CMD_OUTPUT_SIZE);
+  if (ret >= 0) {
+    out = buf;
+  }
+  free(buf);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  run_ms = ((end.tv_sec - start.tv_sec) * 1000
+            + (end.tv_nsec - start.tv_nsec) / 1000000);
+  return (ret >= 0);
+}
+
+/* refresh the cached output of "cmd" in a detached process so that the
+ * completion doesn't wait for it.
+ */
+static void
+_refresh_comp_cmd_async(CompCache& cache, const string& cmd)
+{
+  string gen = cache.getGen(true);
+  if (gen.empty() || !cache.lockRefresh(cmd)) {
+    // can't cache or already being refreshed
+    return;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    cache.unlockRefresh(cmd);
+    return;
+  }
+  if (pid == 0) {
+    // fork again so that the refreshing process is not our child
+    pid_t rpid = fork();
+    if (rpid < 0) {
+      // no refresh after all
+      cache.unlockRefresh(cmd);
+    }
+    if (rpid != 0) {
+      _exit(0);
+    }
+    setsid();
+    int fd = open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+      dup2(fd, 0);
+      dup2(fd, 1);
+      dup2(fd, 2);
+      if (fd > 2) {
+        close(fd);
+      }
+    }
+    string out;
+    unsigned int run_ms = 0;
+    if (_run_comp_cmd(cmd, out, run_ms)) {
+      cache.put(cmd, gen, out, run_ms);
+    }
+    cache.unlockRefresh(cmd);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+/* get the output of "allowed"/"enumeration" command "cmd" for completion
+ * using the completion cache. the output is cached under the whole command
+ * (which includes COMP_WORDS, since the command may use any of them).
+ * a slow command whose cached output is stale is refreshed in the
+ * background, and the stale output is used in the meantime.
+ * return false if the command fails.
+ */
+static bool
+_get_comp_cmd_output(CompCache& cache, const string& cmd, string& out)
+{
+  unsigned int run_ms = 0;
+  switch (cache.get(cmd, true, out, run_ms)) {
+  case CompCache::FRESH:
+    return true;
+  case CompCache::STALE:
+    if (run_ms >= CompCache::C_SLOW_MS) {
+      _refresh_comp_cmd_async(cache, cmd);
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  // get the generation first in case the config changes in the meantime
+  string gen = cache.getGen(true);
+  if (!_run_comp_cmd(cmd, out, run_ms)) {
+    return false;
+  }
+  cache.put(cmd, gen, out, run_ms);
+  return true;
+}
+
 /* set "env" arg to the environment string needed for "completion".
  * return true if successful.
  *
@@ -629,6 +796,7 @@ Cstore::getCompletionEnv(const Cpath& comps, string& env)
   bool exists_only = (cmd == "delete" || cmd == "show"
                       || cmd == "comment" || cmd == "activate"
                       || cmd == "deactivate");
+  CompCache cache(get_comp_cache_dir());
 
   /* at this point, pcomps contains the command line arguments minus the
    * "command" and the last one.
@@ -692,12 +860,13 @@ Cstore::getCompletionEnv(const Cpath& comps, string& env)
      * must not use def in this block.
      */
     vector<string> ufvec;
+    MapT<string, string> tmpl_help;
     if (exists_only) {
       // only return existing config nodes
       get_all_child_node_names(ufvec, false, true);
     } else {
       // return all template children
-      get_all_tmpl_child_node_names(ufvec);
+      get_tmpl_child_help(cache, pcomps, ufvec, tmpl_help);
     }
     for (size_t i = 0; i < ufvec.size(); i++) {
       if (last_comp == ""
@@ -723,15 +892,21 @@ Cstore::getCompletionEnv(const Cpath& comps, string& env)
     reset_paths();
     for (size_t i = 0; i < comp_vals.size(); i++) {
       pair<string, string> hpair(comp_vals[i], "");
-      pcomps.push(comp_vals[i]);
-      tr1::shared_ptr<Ctemplate> cdef(get_parsed_tmpl(pcomps, false));
-      if (cdef.get() && cdef->getNodeHelp()) {
-        hpair.second = cdef->getNodeHelp();
+      MapT<string, string>::iterator hit = tmpl_help.find(comp_vals[i]);
+      if (hit != tmpl_help.end()) {
+        hpair.second = hit->second;
       } else {
+        pcomps.push(comp_vals[i]);
+        tr1::shared_ptr<Ctemplate> cdef(get_parsed_tmpl(pcomps, false));
+        if (cdef.get() && cdef->getNodeHelp()) {
+          hpair.second = cdef->getNodeHelp();
+        }
+        pcomps.pop();
+      }
+      if (hpair.second.empty()) {
         hpair.second = "<No help text available>";
       }
       help_pairs.push_back(hpair);
-      pcomps.pop();
     }
     // last comp is not value
     last_comp_val = false;
@@ -771,37 +946,33 @@ Cstore::getCompletionEnv(const Cpath& comps, string& env)
         cmd_str += comps[i];
         cmd_str += "'";
       }
-      cmd_str += "); ";
+      string cmd_tail = "); ";
       if (def->getEnumeration()) {
-        cmd_str += (C_ENUM_SCRIPT_DIR + "/" + def->getEnumeration());
+        cmd_tail += (C_ENUM_SCRIPT_DIR + "/" + def->getEnumeration());
       } else {
         string astr = def->getAllowed();
         shell_escape_squotes(astr);
         getAllowedVarRef(astr);
-        cmd_str += "_cstore_internal_allowed () { eval '";
-        cmd_str += astr;
-        cmd_str += "'; }; _cstore_internal_allowed";
+        cmd_tail += "_cstore_internal_allowed () { eval '";
+        cmd_tail += astr;
+        cmd_tail += "'; }; _cstore_internal_allowed";
       }
+      cmd_str += cmd_tail;
 
-      char *buf = (char *) malloc(MAX_CMD_OUTPUT_SIZE);
-      int ret = get_shell_command_output(cmd_str.c_str(), buf,
-                                         MAX_CMD_OUTPUT_SIZE);
-      if (ret > 0) {
+      string out;
+      if (_get_comp_cmd_output(cache, cmd_str, out)) {
         // '<' and '>' need to be escaped
-        char *ptr = buf;
-        while (*ptr) {
-          if (*ptr == '<' || *ptr == '>') {
+        for (size_t i = 0; i < out.length(); i++) {
+          if (out[i] == '<' || out[i] == '>') {
             comp_string += "\\";
           }
-          comp_string += *ptr;
-          ptr++;
+          comp_string += out[i];
         }
       }
       /* note that for "enumeration" and "allowed", comp_string is the
        * complete output of the command and it is to be evaled by the
        * shell into an array of values.
        */
-      free(buf);
     } else if (!exists_only && def->getActions(syntax_act)) {
       // look for "self ref in values" from syntax
       const valstruct *vals
@@ -1668,6 +1839,10 @@ Cstore::cfgPathDefault(const Cpath& path_comps, bool active_cfg)
 bool
 Cstore::cfgPathEffective(const Cpath& path_comps)
 {
+  if (_eff_cache) {
+    return get_cached_effective(path_comps);
+  }
+
   tr1::shared_ptr<Ctemplate> def(get_parsed_tmpl(path_comps, false));
   if (!def.get()) {
     // invalid path
@@ -1811,6 +1986,138 @@ Cstore::cfgPathGetEffectiveValues(const Cpath& path_comps,
   return (values.size() > 0);
 }
 
+/* check whether each of "rel_paths" (relative to "base") exists in working
+ * config or active config. see cfgPathExists().
+ *   results: (output) results in the same order as "rel_paths".
+ * unlike checking the full paths one by one, "base" and its ancestors are
+ * only looked up (and checked for "deactivated") once.
+ */
+void
+Cstore::cfgPathsExist(const Cpath& base, const vector<Cpath>& rel_paths,
+                      vector<bool>& results, bool active_cfg)
+{
+  if (!active_cfg) {
+    ASSERT_IN_SESSION;
+  }
+
+  results.assign(rel_paths.size(), false);
+  if (cfgPathDeactivated(base, active_cfg)) {
+    // everything at or below a deactivated node is deactivated
+    return;
+  }
+
+  // an empty relative path refers to "base" itself, which may be a value
+  bool base_exists = false;
+  for (size_t i = 0; i < rel_paths.size(); i++) {
+    if (rel_paths[i].size() == 0) {
+      base_exists = (base.size() > 0
+                     && cfg_path_exists(base, active_cfg, true));
+      break;
+    }
+  }
+
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  append_cfg_path(base);
+  if (base.size() > 0 && !cfg_node_exists(active_cfg)) {
+    // nothing below "base"
+    for (size_t i = 0; i < rel_paths.size(); i++) {
+      results[i] = (rel_paths[i].size() == 0 && base_exists);
+    }
+    return;
+  }
+  for (size_t i = 0; i < rel_paths.size(); i++) {
+    results[i] = (rel_paths[i].size() == 0
+                  ? base_exists : rel_cfg_path_exists(rel_paths[i],
+                                                      active_cfg));
+  }
+}
+
+/* check whether each of "rel_paths" (relative to "base") is "effective".
+ * see cfgPathEffective().
+ *   results: (output) results in the same order as "rel_paths".
+ */
+void
+Cstore::cfgPathsEffective(const Cpath& base, const vector<Cpath>& rel_paths,
+                          vector<bool>& results)
+{
+  bool in_session = inSession();
+  vector<bool> in_active, in_work;
+  if (!_eff_cache) {
+    cfgPathsExist(base, rel_paths, in_active, true);
+    if (in_session) {
+      cfgPathsExist(base, rel_paths, in_work, false);
+    }
+  }
+
+  results.assign(rel_paths.size(), false);
+  Cpath ppath(base);
+  for (size_t i = 0; i < rel_paths.size(); i++) {
+    const Cpath& rel = rel_paths[i];
+    for (size_t j = 0; j < rel.size(); j++) {
+      ppath.push(rel[j]);
+    }
+    if (_eff_cache) {
+      // already memoized per path
+      results[i] = cfgPathEffective(ppath);
+      for (size_t j = 0; j < rel.size(); j++) {
+        ppath.pop();
+      }
+      continue;
+    }
+    tr1::shared_ptr<Ctemplate> def(get_parsed_tmpl(ppath, false));
+    if (def.get()) {
+      results[i] = (in_session
+                    ? commit::isCommitPathEffective(*this, ppath, def,
+                                                    in_active[i], in_work[i])
+                    : in_active[i]);
+    }
+    for (size_t j = 0; j < rel.size(); j++) {
+      ppath.pop();
+    }
+  }
+}
+
+void
+Cstore::setEffectiveCache(bool enable)
+{
+  if (enable && !_eff_cache) {
+    _eff_cache = new EffectiveCache();
+  } else if (!enable && _eff_cache) {
+    delete _eff_cache;
+    _eff_cache = 0;
+  }
+}
+
+/* call "func" with the name of each child node of specified path in
+ * working config or active config until it returns false. the nodes are
+ * the same as those returned by cfgPathGetChildNodes() but are not sorted.
+ */
+void
+Cstore::cfgPathForEachChildNode(const Cpath& path_comps, ChildNodeFuncT func,
+                                void *arg, bool active_cfg)
+{
+  if (!active_cfg) {
+    ASSERT_IN_SESSION;
+  }
+
+  if (cfgPathDeactivated(path_comps, active_cfg)) {
+    // deactivated node. nop.
+    return;
+  }
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  append_cfg_path(path_comps);
+  ChildNodeFilter filter = { this, func, arg, active_cfg };
+  for_each_child_node_name_impl(for_each_active_child, &filter, active_cfg);
+}
+
 /* get the value string that corresponds to specified variable ref string.
  *   ref_str: var ref string (e.g., "./cost/@").
  *   type: (output) the node type.
@@ -1875,6 +2182,15 @@ Cstore::setVarRef(const char *ref_str, const char *value, bool to_active)
     if (def.get() && def->isSingleLeafNode()) {
       // currently only support single-value node
       append_cfg_path(pcomps);
+      /* the config is changing, so drop what has been memoized. this is
+       * rare, so don't bother finding the affected entries.
+       */
+      if (_vref_cache) {
+        _vref_cache->clear();
+      }
+      if (_eff_cache) {
+        _eff_cache->entries.clear();
+      }
       if (write_value(value, to_active)) {
         return true;
       }
@@ -1883,6 +2199,26 @@ Cstore::setVarRef(const char *ref_str, const char *value, bool to_active)
   return false;
 }
 
+void
+Cstore::setVarRefCache(bool enable)
+{
+  if (enable && !_vref_cache) {
+    _vref_cache = new VarRefCache();
+  } else if (!enable && _vref_cache) {
+    delete _vref_cache;
+    _vref_cache = 0;
+  }
+}
+
+void
+Cstore::clearVarRefCache()
+{
+  if (_vref_cache) {
+    setVarRefCache(false);
+    setVarRefCache(true);
+  }
+}
+
 /* perform deactivate operation on a node, i.e., make the node
  * "marked deactivated".
  * note: assume all validations have been peformed (see activate.cpp).
@@ -1966,16 +2302,28 @@ Cstore::loadFile(const char *filename)
 
   delete froot;
   // "apply" the changes to the working config
+  set_pure_eval_scope(true);
   for (size_t i = 0; i < del_list.size(); i++) {
     if (!deleteCfgPath(del_list[i])) {
       print_path_vec("Delete [", "] failed\n", del_list[i], "'");
     }
   }
+  /* apply the sets as a batch. the set list is in tree order, so paths
+   * sharing a prefix are consecutive, and the prefix only needs to be
+   * validated, checked, and marked once. note that the list must not be
+   * reordered since the order of values of multi-value nodes matters.
+   */
+  BatchState batch;
+  _batch = &batch;
   for (size_t i = 0; i < set_list.size(); i++) {
     if (!validateSetPath(set_list[i]) || !setCfgPath(set_list[i])) {
       print_path_vec("Set [", "] failed\n", set_list[i], "'");
     }
   }
+  if (!flush_changed_marks()) {
+    output_user("Failed to mark changes\n");
+  }
+  _batch = 0;
   for (size_t i = 0; i < com_list.size(); i++) {
     if (!commentCfgPath(com_list[i])) {
       string comment = string(com_list[i][com_list[i].size()-1]);
@@ -1985,7 +2333,73 @@ Cstore::loadFile(const char *filename)
       }
     }
   }
+  set_pure_eval_scope(false);
+
+  return true;
+}
+
+/* load specified config file at boot. unlike loadFile(), this does not
+ * use a config session. the file is parsed once, the parsed tree is
+ * written directly to the working config of a "boot session" (see
+ * setupBootSession()), and the result is committed and installed as the
+ * active config (see commit::doBootCommit()).
+ * return true if successful. otherwise return false.
+ */
+bool
+Cstore::bootLoadFile(const char *filename)
+{
+  FILE *fin = fopen(filename, "r");
+  if (!fin) {
+    output_user("Failed to open specified config file\n");
+    return false;
+  }
+
+  // get the config tree from the file
+  uint64_t tstart = commit_trace_begin();
+  CfgNode *froot = cparse::parse_file(fin, *this);
+  commit_trace_end(tstart, "commit", "parse config file", filename);
+  fclose(fin);
+  if (!froot) {
+    output_user("Failed to parse specified config file\n");
+    return false;
+  }
+
+  if (!setupBootSession()) {
+    output_user("Failed to set up boot session\n");
+    delete froot;
+    return false;
+  }
+
+  // write the tree to the working config
+  {
+    commit::TraceScope trace("commit", "write working config");
+    #if __GNUC__ < 6
+    auto_ptr<SavePaths> save(create_save_paths());
+    #else
+    unique_ptr<SavePaths> save(create_save_paths());
+    #endif
+    reset_paths();
+    Cpath pcomps;
+    set_pure_eval_scope(true);
+    write_boot_tree(*froot, pcomps);
+    set_pure_eval_scope(false);
+  }
+  delete froot;
 
+  /* commit the working config, which (unlike the parsed tree) also has
+   * the default values.
+   */
+  Cpath args;
+  tstart = commit_trace_begin();
+  CfgNode wroot(*this, args, false, true);
+  commit_trace_end(tstart, "commit", "build working config", NULL);
+  if (!commit::doBootCommit(*this, wroot)) {
+    /* e.g., commit lock or installing the active config failed. don't
+     * leave the boot session behind (nop if it has been removed).
+     */
+    teardownBootSession();
+    return false;
+  }
   return true;
 }
 
@@ -2070,10 +2484,13 @@ Cstore::executeTmplActions(char *at_str, const Cpath& path,
   append_tmpl_path(path);
 
   var_ref_handle = (void *) this;
+  bool had_vref_cache = (_vref_cache != 0);
+  setVarRefCache(true);
   // const_cast for legacy code
 
   bool ret = execute_list(const_cast<vtw_node *>(actions), def,
                           sdisp.c_str());
+  setVarRefCache(had_vref_cache);
   var_ref_handle = NULL;
   return ret;
 }
@@ -2156,6 +2573,32 @@ Cstore::assert_internal(bool cond, const char *fmt, ...)
   va_end(alist);
 }
 
+/* take a snapshot of the active config (see getActiveSnapshotInfo()) so
+ * that readers don't need to walk it. the snapshot is always taken of the
+ * whole config regardless of the current level.
+ */
+bool
+Cstore::write_active_snapshot()
+{
+  string file, stamp;
+  if (!getActiveSnapshotInfo(file, stamp)) {
+    return false;
+  }
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  reset_paths(true);
+  Cpath p;
+  CfgNode root(*this, p, true, true, false);
+  if (!CfgSnapshot::build(root, stamp, file)) {
+    output_internal("no active config snapshot [%s]\n", file.c_str());
+    return false;
+  }
+  return true;
+}
+
 
 ////// private functions
 bool
@@ -2175,6 +2618,15 @@ Cstore::sort_nodes(vector<string>& nvec, unsigned int sort_alg)
   sort(nvec.begin(), nvec.end(), p->second);
 }
 
+Cstore::SortFuncT
+Cstore::getSortFunc(unsigned int sort_alg)
+{
+  init();
+  MapT<unsigned int, Cstore::SortFuncT>::iterator p
+    = _sort_func_map.find(sort_alg);
+  return (p == _sort_func_map.end() ? NULL : p->second);
+}
+
 /* try to append the logical path to template path.
  *   is_tag: (output) whether the last component is a "tag".
  * return false if logical path is not valid. otherwise return true.
@@ -2293,6 +2745,10 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
      */
     // first scan up to "full path - 1"
     bool valid = true;
+    // in a batch, values along the path only need to be validated once
+    MapT<Cpath, bool, CpathHash> *vcache
+      = ((_batch && do_caching) ? &(_batch->validated) : NULL);
+    Cpath vpath;
     for (size_t i = 0; i < (pcomps->size() - 1); i++) {
       if ((*pcomps)[i][0] == 0) {
         // only the last component is potentially allowed to be empty str
@@ -2300,8 +2756,10 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
         break;
       }
       bool is_tag;
+      vpath.push((*pcomps)[i]);
       if (append_tmpl_path((*pcomps)[i], is_tag)) {
-        if (is_tag && validate_vals) {
+        if (is_tag && validate_vals
+            && !(vcache && vcache->find(vpath) != vcache->end())) {
           /* last comp is tag and want to validate value.
            * note: validate_val() will use the current tmpl path and cfg path.
            *       so need both at the "node" level before calling it.
@@ -2316,6 +2774,9 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
             valid = false;
             break;
           }
+          if (vcache) {
+            (*vcache)[vpath] = true;
+          }
           // restore tmpl path
           append_tmpl_path((*pcomps)[i], is_tag);
         }
@@ -2343,13 +2804,17 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
       if (ttmpl.get()) {
         if (ttmpl->isTag() || ttmpl->isMulti() || !ttmpl->isTypeless()) {
           // case (2). last component is "value".
-          if (validate_vals) {
+          if (validate_vals
+              && !(vcache && vcache->find(*pcomps) != vcache->end())) {
             // validate value
             if (!validate_val(ttmpl, (*pcomps)[pcomps->size() - 1])) {
               // invalid value
               error = "Value validation failed";
               break;
             }
+            if (vcache) {
+              (*vcache)[*pcomps] = true;
+            }
           }
           rtmpl = ttmpl;
           rtmpl->setIsValue(true);
@@ -2569,7 +3034,13 @@ Cstore::set_cfg_path(const Cpath& path_comps, bool output)
     }
 
     // nop if this level already in working (including deactivated)
+    if (_batch && _batch->existing.find(ppath) != _batch->existing.end()) {
+      continue;
+    }
     if (cfg_path_exists(ppath, false, true)) {
+      if (_batch) {
+        _batch->existing[ppath] = true;
+      }
       continue;
     }
 
@@ -2623,10 +3094,18 @@ Cstore::set_cfg_path(const Cpath& path_comps, bool output)
         }
       }
     }
-    if (!mark_changed_with_ancestors()) {
+    // mark at the "node" level
+    Cpath mpath(ppath);
+    if (def->isValue() && !def->isTag()) {
+      mpath.pop();
+    }
+    if (!mark_path_changed(mpath)) {
       ret = false;
       break;
     }
+    if (_batch) {
+      _batch->existing[ppath] = true;
+    }
   }
 
   if (ret && def->isValue() && def->getDefault()) {
@@ -2671,7 +3150,9 @@ Cstore::set_cfg_path(const Cpath& path_comps, bool output)
         // pretend it didn't exist since we changed the status
         path_exists = false;
         // also mark changed
-        ret = mark_changed_with_ancestors();
+        Cpath mpath(path_comps);
+        mpath.pop();
+        ret = mark_path_changed(mpath);
       }
     }
   }
@@ -2686,6 +3167,71 @@ Cstore::set_cfg_path(const Cpath& path_comps, bool output)
   return ret;
 }
 
+/* mark specified "logical path" (which must be at the "node" level) and its
+ * ancestors "changed". note that the current cfg path must be at the
+ * specified path (relative to the saved paths in batch), i.e., same as
+ * mark_changed_with_ancestors().
+ *
+ * in a batch, marking is deferred. since the changes are applied in tree
+ * order, only the deepest path in each "run" needs to be marked (which
+ * takes care of all its ancestors), and this is done when the run ends or
+ * by flush_changed_marks().
+ */
+bool
+Cstore::mark_path_changed(const Cpath& path_comps)
+{
+  if (!_batch) {
+    return mark_changed_with_ancestors();
+  }
+  Cpath& mp = _batch->mark_path;
+  if (_batch->has_mark) {
+    if (path_comps.size() <= mp.size()) {
+      bool is_ancestor = true;
+      for (size_t i = 0; i < path_comps.size(); i++) {
+        if (strcmp(path_comps[i], mp[i]) != 0) {
+          is_ancestor = false;
+          break;
+        }
+      }
+      if (is_ancestor) {
+        // already covered by pending
+        return true;
+      }
+    }
+    bool extends = (mp.size() < path_comps.size());
+    for (size_t i = 0; extends && i < mp.size(); i++) {
+      extends = (strcmp(path_comps[i], mp[i]) == 0);
+    }
+    if (!extends && !flush_changed_marks()) {
+      return false;
+    }
+  }
+  mp = path_comps;
+  _batch->has_mark = true;
+  return true;
+}
+
+// do any pending "changed" marking in a batch
+bool
+Cstore::flush_changed_marks()
+{
+  if (!_batch || !_batch->has_mark) {
+    return true;
+  }
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  /* the mark path is relative to the edit level, but this may be called
+   * in the middle of a set with the cfg path somewhere else.
+   */
+  reset_paths();
+  _batch->has_mark = false;
+  append_cfg_path(_batch->mark_path);
+  return mark_changed_with_ancestors();
+}
+
 /* this is the equivalent of the listNodeStatus() from the original
  * perl API. it provides the "status" ("deleted", "added", "changed",
  * or "static") of each child node of specified path.
@@ -2883,6 +3429,38 @@ Cstore::cfg_value_exists(const string& value, bool active_cfg)
   return (find(vvec.begin(), vvec.end(), value) != vvec.end());
 }
 
+/* check whether "rel_path" exists relative to current work path (or active
+ * path with "active_cfg"). same as cfg_path_exists() on the full path
+ * (without deactivated nodes), but current path itself is assumed to exist
+ * and not be deactivated.
+ */
+bool
+Cstore::rel_cfg_path_exists(const Cpath& rel_path, bool active_cfg)
+{
+  size_t n = rel_path.size();
+  size_t pushed = 0;
+  bool ret = true;
+  while (pushed < n) {
+    push_cfg_path(rel_path[pushed]);
+    ++pushed;
+    if (!cfg_node_exists(active_cfg)) {
+      // doesn't exist as a node. maybe the last one is a value?
+      pop_cfg_path();
+      --pushed;
+      ret = (pushed == n - 1 && cfg_value_exists(rel_path[pushed], active_cfg));
+      break;
+    }
+    if (marked_deactivated(active_cfg)) {
+      ret = false;
+      break;
+    }
+  }
+  for (; pushed > 0; --pushed) {
+    pop_cfg_path();
+  }
+  return ret;
+}
+
 /* validate value at current template path.
  *   def: pointer to parsed template.
  *   val: value to be validated.
@@ -2908,7 +3486,10 @@ Cstore::validate_val(const tr1::shared_ptr<Ctemplate>& def, const char *value)
    * processing. this is a global var in cli_new.c.
    */
   var_ref_handle = (void *) this;
+  bool had_vref_cache = (_vref_cache != 0);
+  setVarRefCache(true);
   bool ret = validate_value(def->getDef(), vbuf.get());
+  setVarRefCache(had_vref_cache);
   var_ref_handle = NULL;
 
   return ret;
@@ -3008,6 +3589,110 @@ Cstore::get_all_child_node_names(vector<string>& cnodes, bool active_cfg,
   }
 }
 
+/* same as cfgPathEffective() using the memoized results. see
+ * setEffectiveCache().
+ */
+bool
+Cstore::get_cached_effective(const Cpath& path_comps)
+{
+  bool in_session = inSession();
+  unsigned long long gen = (in_session ? get_committed_markers_gen() : 0);
+  MapT<Cpath, EffectiveCache::Entry, CpathHash>::iterator it
+    = _eff_cache->entries.find(path_comps);
+  if (it == _eff_cache->entries.end()) {
+    it = _eff_cache->entries.insert(make_pair(path_comps,
+                                              EffectiveCache::Entry())).first;
+    EffectiveCache::Entry& e = it->second;
+    e.def = get_parsed_tmpl(path_comps, false);
+    if (e.def.get()) {
+      e.in_active = cfg_path_exists(path_comps, true, false);
+      e.in_work = (in_session && cfg_path_exists(path_comps, false, false));
+    }
+  } else if (it->second.has_result && it->second.markers_gen == gen) {
+    return it->second.effective;
+  }
+
+  EffectiveCache::Entry& e = it->second;
+  if (!e.def.get()) {
+    // invalid path
+    e.effective = false;
+  } else if (!in_session) {
+    // not in a config session. use active config only.
+    e.effective = e.in_active;
+  } else {
+    e.effective = commit::isCommitPathEffective(*this, path_comps, e.def,
+                                                e.in_active, e.in_work);
+  }
+  e.has_result = true;
+  e.markers_gen = gen;
+  return e.effective;
+}
+
+/* get the template child nodes of current tmpl path and their help
+ * strings ("" if none) for completion. templates only change when packages
+ * are installed, so these are kept in the completion cache.
+ *   path_comps: path of current tmpl path (for get_parsed_tmpl()).
+ */
+void
+Cstore::get_tmpl_child_help(CompCache& cache, const Cpath& path_comps,
+                            vector<string>& cnodes,
+                            MapT<string, string>& help)
+{
+  string key = ("tmpl " + tmpl_path_to_str());
+  string data;
+  unsigned int run_ms = 0;
+  if (cache.get(key, false, data, run_ms) == CompCache::FRESH) {
+    // pairs of NUL-terminated name and help string
+    size_t pos = 0;
+    while (pos < data.length()) {
+      size_t nend = data.find('\0', pos);
+      size_t hend = (nend == data.npos ? nend : data.find('\0', nend + 1));
+      if (hend == data.npos) {
+        break;
+      }
+      string name = data.substr(pos, nend - pos);
+      cnodes.push_back(name);
+      help[name] = data.substr(nend + 1, hend - nend - 1);
+      pos = hend + 1;
+    }
+    return;
+  }
+
+  get_all_tmpl_child_node_names(cnodes);
+  data.clear();
+  // get_parsed_tmpl() takes the whole path
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  reset_paths();
+  Cpath pcomps(path_comps);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    pcomps.push(cnodes[i]);
+    tr1::shared_ptr<Ctemplate> cdef(get_parsed_tmpl(pcomps, false));
+    string h = ((cdef.get() && cdef->getNodeHelp()) ? cdef->getNodeHelp() : "");
+    help[cnodes[i]] = h;
+    data.append(cnodes[i].c_str(), cnodes[i].length() + 1);
+    data.append(h.c_str(), h.length() + 1);
+    pcomps.pop();
+  }
+  cache.put(key, cache.getGen(false), data, 0);
+}
+
+/* used with for_each_child_node_name_impl() to skip deactivated child nodes
+ * of current work path (or active path).
+ */
+bool
+Cstore::for_each_active_child(const char *name, void *arg)
+{
+  ChildNodeFilter *f = static_cast<ChildNodeFilter *>(arg);
+  f->cstore->push_cfg_path(name);
+  bool skip = f->cstore->marked_deactivated(f->active_cfg);
+  f->cstore->pop_cfg_path();
+  return (skip ? true : f->func(name, f->arg));
+}
+
 /* create all child nodes of current work path that have default values
  *   path_comps: path components. MUST match the work path and is only
  *               needed for the get_parsed_tmpl() call.
@@ -3050,6 +3735,121 @@ Cstore::create_default_children(const Cpath& path_comps)
   return ret;
 }
 
+/* write parsed config tree "node" to the working config (see
+ * bootLoadFile()). current work/tmpl paths are at "node", and "path_comps"
+ * is the corresponding path. this is equivalent to setting all paths in
+ * the tree, but each node is created and its value(s) validated once as
+ * the tree is walked top-down. paths that fail are reported and skipped.
+ */
+void
+Cstore::write_boot_tree(const CfgNode& node, Cpath& path_comps)
+{
+  const vector<CfgNode *>& cnodes = node.getChildNodes();
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    const CfgNode& cn = *(cnodes[i]);
+    const char *name = cn.getName().c_str();
+    tr1::shared_ptr<Ctemplate> def(cn.getTmpl());
+    path_comps.push(name);
+    push_cfg_path(name);
+    push_tmpl_path(name);
+    if (cn.isInvalid()) {
+      print_path_vec("Set [", "] failed\n", path_comps, "'");
+    } else if (cn.isTagNode()) {
+      if (!cfg_node_exists(false) && !add_node()) {
+        print_path_vec("Set [", "] failed\n", path_comps, "'");
+      } else {
+        unsigned int tlimit = def->getTagLimit();
+        const vector<CfgNode *>& tnodes = cn.getChildNodes();
+        for (size_t j = 0; j < tnodes.size(); j++) {
+          const CfgNode& tn = *(tnodes[j]);
+          const char *val = tn.getValue().c_str();
+          path_comps.push(val);
+          if (tlimit > 0 && j >= tlimit) {
+            output_user("Cannot set node \"%s\": number of values exceeds "
+                        "limit(%d allowed)\n", val, tlimit);
+          } else if (!validate_val(def, val)) {
+            print_path_vec("Set [", "] failed\n", path_comps, "'");
+          } else {
+            push_cfg_path(val);
+            push_tmpl_path_tag();
+            if (write_boot_node(tn, path_comps)) {
+              write_boot_tree(tn, path_comps);
+            } else {
+              print_path_vec("Set [", "] failed\n", path_comps, "'");
+            }
+            pop_tmpl_path();
+            pop_cfg_path();
+          }
+          path_comps.pop();
+        }
+      }
+    } else if (cn.isLeaf()) {
+      vector<string> vvec;
+      if (cn.isMulti()) {
+        const vector<string>& vals = cn.getValues();
+        for (size_t j = 0; j < vals.size(); j++) {
+          if (validate_val(def, vals[j].c_str())) {
+            vvec.push_back(vals[j]);
+            continue;
+          }
+          path_comps.push(vals[j]);
+          print_path_vec("Set [", "] failed\n", path_comps, "'");
+          path_comps.pop();
+        }
+        unsigned int mlimit = def->getMultiLimit();
+        if (mlimit >= 1 && vvec.size() > mlimit) {
+          output_user("Cannot set value \"%s\": number of values exceeded "
+                      "(%d allowed)\n", vvec[mlimit].c_str(), mlimit);
+          vvec.resize(mlimit);
+        }
+      } else if (validate_val(def, cn.getValue().c_str())) {
+        vvec.push_back(cn.getValue());
+      } else {
+        path_comps.push(cn.getValue());
+        print_path_vec("Set [", "] failed\n", path_comps, "'");
+        path_comps.pop();
+      }
+      if (vvec.size() > 0) {
+        // an explicitly set value is never "default"
+        if (!write_boot_node(cn, path_comps) || !write_value_vec(vvec)
+            || (marked_display_default(false) && !unmark_display_default())) {
+          print_path_vec("Set [", "] failed\n", path_comps, "'");
+        }
+      }
+    } else {
+      // typeless node
+      if (write_boot_node(cn, path_comps)) {
+        write_boot_tree(cn, path_comps);
+      } else {
+        print_path_vec("Set [", "] failed\n", path_comps, "'");
+      }
+    }
+    pop_tmpl_path();
+    pop_cfg_path();
+    path_comps.pop();
+  }
+}
+
+/* create the node at current work path (unless it already exists) and set
+ * its comment and deactivated status from parsed node "node".
+ * return true if successful. otherwise return false.
+ */
+bool
+Cstore::write_boot_node(const CfgNode& node, Cpath& path_comps)
+{
+  if (!cfg_node_exists(false)
+      && (!add_node() || !create_default_children(path_comps))) {
+    return false;
+  }
+  if (node.getComment().length() > 0 && !set_comment(node.getComment())) {
+    return false;
+  }
+  if (node.isDeactivated() && !mark_deactivated()) {
+    return false;
+  }
+  return true;
+}
+
 /* return environment string for "edit"-related operations based on current
  * work/tmpl paths.
  */
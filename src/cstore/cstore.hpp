@@ -52,11 +52,16 @@ namespace cstore { // begin namespace cstore
 
 using namespace std;
 
+class CompCache;
+
 class Cstore {
 public:
-  Cstore() { init(); };
+  Cstore() : _batch(0), _eff_cache(0), _vref_cache(0) { init(); };
   Cstore(string& env);
-  virtual ~Cstore() {};
+  virtual ~Cstore() {
+    setEffectiveCache(false);
+    setVarRefCache(false);
+  };
 
   // factory functions
   static Cstore *createCstore(bool use_edit_level = false);
@@ -104,6 +109,7 @@ public:
   bool getParsedTmpl(const Cpath& path_comps, MapT<string, string>& tmap,
                      bool allow_val = true);
   void tmplGetChildNodes(const Cpath& path_comps, vector<string>& cnodes);
+  bool getTmplPathStr(const Cpath& path_comps, string& tmpl_path);
 
   /******
    * functions for actual CLI operations:
@@ -168,6 +174,12 @@ public:
   virtual bool setupSession() = 0;
   virtual bool teardownSession() = 0;
   virtual bool inSession() = 0;
+  /* boot-time "session" (see bootLoadFile()). this only sets up the
+   * session directories (i.e., no union mount), and the active config
+   * must be empty.
+   */
+  virtual bool setupBootSession() = 0;
+  virtual bool teardownBootSession() = 0;
   // commit
   bool unmarkCfgPathChanged(const Cpath& path_comps);
   bool executeTmplActions(char *at_str, const Cpath& path,
@@ -177,13 +189,30 @@ public:
   bool markCfgPathCommitted(const Cpath& path_comps, bool is_delete);
   virtual bool clearCommittedMarkers() = 0;
   virtual bool commitConfig(commit::PrioNode& pnode) = 0;
+  /* install the result of a boot-time commit as the active config and
+   * remove the boot session (see setupBootSession()).
+   */
+  virtual bool commitBootConfig(commit::PrioNode& pnode) = 0;
   virtual bool getCommitLock() = 0;
     /* note: the getCommitLock() function must guarantee lock release/cleanup
      * upon process termination (either normally or abnormally). there is no
      * separate call for releasing the lock.
      */
+  // templates
+  virtual bool compileTemplates() = 0;
+  /* get a "stamp" identifying the currently installed templates, which
+   * changes when they are recompiled (see compileTemplates()). return false
+   * if not available.
+   */
+  virtual bool getTmplStamp(string& stamp) = 0;
+  /* active config snapshot (see cnode/cnode-snapshot.hpp). get the
+   * snapshot file and a "stamp" identifying the current state of the active
+   * config. return false if not supported.
+   */
+  virtual bool getActiveSnapshotInfo(string& file, string& stamp) = 0;
   // load
   bool loadFile(const char *filename);
+  bool bootLoadFile(const char *filename);
 
   /******
    * these functions are observers of the current "working config" or
@@ -242,6 +271,33 @@ public:
   bool cfgPathGetEffectiveValues(const Cpath& path_comps,
                                  vector<string>& values);
 
+  /* batch observers for callers that query many paths under a common
+   * "base" path. each of "rel_paths" is relative to "base", which is only
+   * resolved once (including whether it is deactivated), and results are
+   * in the same order as "rel_paths". otherwise these are the same as
+   * cfgPathExists() and cfgPathEffective() on the full paths.
+   */
+  void cfgPathsExist(const Cpath& base, const vector<Cpath>& rel_paths,
+                     vector<bool>& results, bool active_cfg = false);
+  void cfgPathsEffective(const Cpath& base, const vector<Cpath>& rel_paths,
+                         vector<bool>& results);
+
+  /* call "func" with the name of each child node of specified path in
+   * working config or active config (in no particular order) until it
+   * returns false. same nodes as cfgPathGetChildNodes() without building
+   * and sorting the list.
+   */
+  typedef bool (*ChildNodeFuncT)(const char *name, void *arg);
+  void cfgPathForEachChildNode(const Cpath& path_comps, ChildNodeFuncT func,
+                               void *arg, bool active_cfg = false);
+
+  /* memoize the "effective" observers above. this is only valid while
+   * neither working config nor active config changes, i.e., during the
+   * execution of commit actions. the results are still kept up to date
+   * with the committed markers.
+   */
+  void setEffectiveCache(bool enable);
+
   /******
    * "deactivate-aware" observers of the current working or active config.
    * these are the only functions that are allowed to see the "deactivate"
@@ -296,6 +352,9 @@ public:
                         unsigned int sort_alg = SORT_DEFAULT) {
     sort_nodes(nvec, sort_alg);
   };
+  // comparison used by sortNodes(). NULL if sort_alg is not valid.
+  typedef bool (*SortFuncT)(std::string, std::string);
+  static SortFuncT getSortFunc(unsigned int sort_alg = SORT_DEFAULT);
 
   /* these are internal API functions and operate on current cfg and
    * tmpl paths during cstore operations. they are only used to work around
@@ -304,6 +363,16 @@ public:
    */
   char *getVarRef(const char *ref_str, vtw_type_e& type, bool from_active);
   bool setVarRef(const char *ref_str, const char *value, bool to_active);
+  /* memoize the config lookups done for var refs. this is enabled for the
+   * duration of each operation that processes var refs (and can be enabled
+   * for longer, e.g., during commit, if the configs don't change in the
+   * meantime). setVarRef() keeps it coherent.
+   */
+  void setVarRefCache(bool enable);
+  /* drop the memoized lookups (nop if not enabled), e.g., after another
+   * process may have set var refs (see parallel commit).
+   */
+  void clearVarRefCache();
 
 protected:
   class SavePaths {
@@ -317,11 +386,23 @@ protected:
   static void output_internal(const char *fmt, ...);
   static void exit_internal(const char *fmt, ...);
   static void assert_internal(bool cond, const char *fmt, ...);
+  // must be called when the active config has been completely updated
+  bool write_active_snapshot();
 
 private:
   ////// member class
   // for variable reference
   class VarRef;
+  class VarRefCache;
+  // for applying changes in batch
+  class BatchState;
+  // for memoizing effectiveness
+  class EffectiveCache;
+
+  ////// member
+  BatchState *_batch; // only set while applying a batch
+  EffectiveCache *_eff_cache; // only set while enabled
+  VarRefCache *_vref_cache; // only set while enabled
 
   ////// virtual
   /* "path modifiers"
@@ -357,6 +438,8 @@ private:
   virtual bool remove_node() = 0;
   virtual void get_all_child_node_names_impl(vector<string>& cnodes,
                                              bool active_cfg = false) = 0;
+  virtual void for_each_child_node_name_impl(ChildNodeFuncT func, void *arg,
+                                             bool active_cfg = false) = 0;
   virtual void get_all_tmpl_child_node_names(vector<string>& cnodes) = 0;
   virtual bool write_value_vec(const vector<string>& vvec,
                                bool active_cfg = false) = 0;
@@ -400,9 +483,16 @@ private:
   virtual void get_edit_level(Cpath& path_comps) = 0;
   virtual bool edit_level_at_root() = 0;
 
+  // directory for the completion cache of the session (see CompCache)
+  virtual string get_comp_cache_dir() = 0;
+
   // functions for commit operation
   virtual bool marked_committed(bool is_delete) = 0;
   virtual bool mark_committed(bool is_delete) = 0;
+  /* return a number that changes whenever the committed markers (possibly
+   * written by other processes) change.
+   */
+  virtual unsigned long long get_committed_markers_gen() = 0;
 
   // these are for testing/debugging
   virtual string cfg_path_to_str() = 0;
@@ -410,7 +500,6 @@ private:
 
   ////// implemented
   // for sorting
-  typedef bool (*SortFuncT)(std::string, std::string);
   static MapT<unsigned int, SortFuncT> _sort_func_map;
 
   static bool sort_func_deb_version(string a, string b);
@@ -465,7 +554,13 @@ private:
                                  Cpath& rn_args);
   bool cfg_path_exists(const Cpath& path_comps, bool active_cfg,
                        bool include_deactivated);
+  bool get_cached_effective(const Cpath& path_comps);
+  void get_tmpl_child_help(CompCache& cache, const Cpath& path_comps,
+                           vector<string>& cnodes,
+                           MapT<string, string>& help);
   bool set_cfg_path(const Cpath& path_comps, bool output);
+  bool mark_path_changed(const Cpath& path_comps);
+  bool flush_changed_marks();
   void get_child_nodes_status(const Cpath& path_comps,
                               MapT<string, string>& cmap,
                               vector<string> *sorted_keys);
@@ -490,15 +585,25 @@ private:
   };
   void get_all_child_node_names(vector<string>& cnodes, bool active_cfg,
                                 bool include_deactivated);
+  struct ChildNodeFilter {
+    Cstore *cstore;
+    ChildNodeFuncT func;
+    void *arg;
+    bool active_cfg;
+  };
+  static bool for_each_active_child(const char *name, void *arg);
 
   // observers for work path or active path
   bool cfg_value_exists(const string& value, bool active_cfg);
+  bool rel_cfg_path_exists(const Cpath& rel_path, bool active_cfg);
 
   // these operate on both current tmpl and work paths
   bool validate_val(const tr1::shared_ptr<Ctemplate>& def, const char *value);
   bool create_default_children(const Cpath& path_comps); /* this requires
     * path_comps but DOES operate on current work path.
     */
+  void write_boot_tree(const cnode::CfgNode& node, Cpath& path_comps);
+  bool write_boot_node(const cnode::CfgNode& node, Cpath& path_comps);
   void get_edit_env(string& env);
 
   // util functions
@@ -32,6 +32,8 @@
 
 #include <cli_cstore.h>
 #include <cstore/unionfs/cstore-unionfs.hpp>
+#include <cstore/unionfs/tmpl-db.hpp>
+#include <cstore/cstore-comp-cache.hpp>
 #include <cnode/cnode.hpp>
 #include <commit/commit-algorithm.hpp>
 
@@ -46,10 +48,15 @@ const string UnionfsCstore::C_ENV_ACTIVE_ROOT
   = "VYATTA_ACTIVE_CONFIGURATION_DIR";
 const string UnionfsCstore::C_ENV_CHANGE_ROOT = "VYATTA_CHANGES_ONLY_DIR";
 const string UnionfsCstore::C_ENV_TMP_ROOT = "VYATTA_CONFIG_TMP";
+const string UnionfsCstore::C_ENV_TMPL_DB = "VYATTA_CONFIG_TEMPLATE_DB";
+const string UnionfsCstore::C_ENV_COMMIT_INCREMENTAL
+  = "VYATTA_COMMIT_INCREMENTAL";
 
 // default root dirs/paths
 const string UnionfsCstore::C_DEF_TMPL_ROOT
   = "/opt/vyatta/share/vyatta-cfg/templates";
+const string UnionfsCstore::C_DEF_TMPL_DB
+  = "/opt/vyatta/share/vyatta-cfg/templates.db";
 const string UnionfsCstore::C_DEF_CFG_ROOT
   = "/opt/vyatta/config";
 const string UnionfsCstore::C_DEF_ACTIVE_ROOT
@@ -68,12 +75,21 @@ const string UnionfsCstore::C_MARKER_CHANGED = ".modified";
 const string UnionfsCstore::C_MARKER_UNSAVED = ".unsaved";
 const string UnionfsCstore::C_MARKER_UNIONFS = ".unionfs-fuse";
 const string UnionfsCstore::C_COMMITTED_MARKER_FILE = ".changes";
+const string UnionfsCstore::C_COMP_CACHE_DIR = "comp-cache";
 const string UnionfsCstore::C_COMMENT_FILE = ".comment";
 const string UnionfsCstore::C_TAG_NAME = "node.tag";
 const string UnionfsCstore::C_VAL_NAME = "node.val";
 const string UnionfsCstore::C_DEF_NAME = "node.def";
 const string UnionfsCstore::C_COMMIT_LOCK_FILE = "/opt/vyatta/config/.lock";
 
+// incremental commit journal
+const string UnionfsCstore::C_JOURNAL_SUFFIX = ".journal";
+const string UnionfsCstore::C_JOURNAL_OPS_FILE = "ops";
+const string UnionfsCstore::C_JOURNAL_STAGE_DIR = "stage";
+
+// active config snapshot
+const string UnionfsCstore::C_SNAPSHOT_SUFFIX = ".snapshot";
+
 pid_t pid;
 int status;
 int commpipe[2];
@@ -167,6 +183,135 @@ _unescape_path_name(const string& path)
   return npath;
 }
 
+/* in-memory template trie.
+ *
+ * templates don't change during the life of a process, so the template
+ * tree is kept in memory and each template dir is only listed once (when
+ * it is first visited). template path resolution (tmpl_node_exists()),
+ * child listing (get_all_tmpl_child_node_names()), and the node.def check
+ * (tmpl_parse()) are then done without touching the filesystem.
+ *
+ * the trie nodes of the current tmpl_path are kept in step with it by the
+ * path modifiers (see tmpl_trie_nodes), so a lookup doesn't have to walk
+ * down from the root.
+ */
+class TmplTrieNode {
+public:
+  TmplTrieNode(const string& dir)
+    : _dir(dir), _listed(false), _has_def(false) {};
+  ~TmplTrieNode() {
+    MapT<string, TmplTrieNode *>::iterator it = _children.begin();
+    for (; it != _children.end(); ++it) {
+      delete it->second;
+    }
+  };
+
+  // "name" is escaped
+  TmplTrieNode *getChild(const string& name) {
+    list();
+    MapT<string, TmplTrieNode *>::iterator it = _children.find(name);
+    return (it != _children.end() ? it->second : NULL);
+  };
+  const vector<string>& getNodeNames() {
+    list();
+    return _node_names;
+  };
+  // return false if the dir doesn't have a node.def
+  bool getDef(struct stat& st) {
+    list();
+    if (_has_def) {
+      st = _def_st;
+    }
+    return _has_def;
+  };
+
+private:
+  string _dir;
+  bool _listed;
+  MapT<string, TmplTrieNode *> _children; // all subdirs (escaped names)
+  vector<string> _node_names; // see check_dir_entries() (unescaped)
+  bool _has_def;
+  struct stat _def_st;
+
+  void list() {
+    if (_listed) {
+      return;
+    }
+    _listed = true;
+    try {
+      b_fs::directory_iterator di(_dir);
+      for (; di != b_fs::directory_iterator(); ++di) {
+        if (!b_fs::is_directory(di->status())) {
+          continue;
+        }
+        string cname = di->path().filename().string();
+        _children[cname] = new TmplTrieNode(_dir + "/" + cname);
+        if (cname.length() > 0 && cname[0] != '.') {
+          _node_names.push_back(_unescape_path_name(cname));
+        }
+      }
+    } catch (...) {
+      // treat as empty
+    }
+    string def = _dir + "/" + UnionfsCstore::C_DEF_NAME;
+    _has_def = (stat(def.c_str(), &_def_st) == 0
+                && S_ISREG(_def_st.st_mode));
+  };
+};
+
+static MapT<string, TmplTrieNode *> _tmpl_tries;
+
+/* get the trie nodes for template dir "tpath" and its ancestors under
+ * "troot", i.e., "nodes[0]" is for "troot" and "nodes.back()" is for
+ * "tpath". a node is NULL if the corresponding path is not a template dir.
+ * return false if "tpath" cannot be handled by the trie (i.e., not under
+ * "troot").
+ */
+static bool
+_get_tmpl_trie_nodes(const FsPath& troot, const FsPath& tpath,
+                     vector<TmplTrieNode *>& nodes)
+{
+  string root = troot.path_cstr();
+  string dir = tpath.path_cstr();
+  nodes.clear();
+  if (dir.compare(0, root.length(), root) != 0
+      || (dir.length() > root.length() && dir[root.length()] != '/')) {
+    return false;
+  }
+
+  TmplTrieNode *node = NULL;
+  MapT<string, TmplTrieNode *>::iterator it = _tmpl_tries.find(root);
+  if (it != _tmpl_tries.end()) {
+    node = it->second;
+  } else {
+    bool is_dir = false;
+    try {
+      is_dir = b_fs::is_directory(root);
+    } catch (...) {
+    }
+    if (is_dir) {
+      node = new TmplTrieNode(root);
+      _tmpl_tries[root] = node;
+    }
+  }
+  nodes.push_back(node);
+
+  // walk down from root
+  size_t start = root.length();
+  while (start < dir.length()) {
+    size_t end = dir.find('/', start + 1);
+    if (end == string::npos) {
+      end = dir.length();
+    }
+    if (node) {
+      node = node->getChild(dir.substr(start + 1, end - start - 1));
+    }
+    nodes.push_back(node);
+    start = end;
+  }
+  return true;
+}
+
 // Fall-through for Boost's filesystem::copy_file "complexity"
 void stream_file( const char* srce_file, const char* dest_file )
 {
@@ -226,6 +371,7 @@ vector<int> getActiveCommits()
  *       valid.
  */
 UnionfsCstore::UnionfsCstore(bool use_edit_level)
+  : active_journal_checked(false)
 {
   // set up root dir strings
   char *val;
@@ -291,7 +437,7 @@ UnionfsCstore::UnionfsCstore(bool use_edit_level)
  *       explicit session setup/teardown functions as needed.
  */
 UnionfsCstore::UnionfsCstore(const string& sid, string& env)
-  : Cstore(env)
+  : Cstore(env), active_journal_checked(false)
 {
   tmpl_root = C_DEF_TMPL_ROOT;
   tmpl_path = tmpl_root;
@@ -540,6 +686,63 @@ UnionfsCstore::teardownSession()
   return ret;
 }
 
+/* set up the boot session associated with this object (see
+ * Cstore::bootLoadFile()). the session directories are created, but the
+ * work root is a plain directory instead of a union mount. this is only
+ * allowed when the active config is empty, i.e., at boot.
+ */
+bool
+UnionfsCstore::setupBootSession()
+{
+  string wstr = work_root.path_cstr();
+  if (wstr.empty() || wstr.find(C_DEF_WORK_PREFIX) != 0) {
+    output_internal("setup invalid boot session [%s]\n", wstr.c_str());
+    return false;
+  }
+  if (path_exists(work_root)) {
+    output_user("Configuration session already exists\n");
+    return false;
+  }
+  if (path_exists(active_root) && !is_directory_empty(active_root)) {
+    output_user("Active configuration is not empty\n");
+    return false;
+  }
+  try {
+    b_fs::create_directories(active_root.path_cstr());
+    b_fs::create_directories(work_root.path_cstr());
+    b_fs::create_directories(change_root.path_cstr());
+    b_fs::create_directories(tmp_root.path_cstr());
+  } catch (...) {
+    output_internal("setup boot session failed to create directories\n");
+    teardownBootSession();
+    return false;
+  }
+  return true;
+}
+
+/* remove the boot session directories (see setupBootSession()). this is
+ * done when the boot commit installs the active config, and whenever the
+ * boot load fails after the session has been set up.
+ */
+bool
+UnionfsCstore::teardownBootSession()
+{
+  string wstr = work_root.path_cstr();
+  if (wstr.empty() || wstr.find(C_DEF_WORK_PREFIX) != 0) {
+    output_internal("teardown invalid boot session [%s]\n", wstr.c_str());
+    return false;
+  }
+  try {
+    b_fs::remove_all(work_root.path_cstr());
+    b_fs::remove_all(change_root.path_cstr());
+    b_fs::remove_all(tmp_root.path_cstr());
+  } catch (...) {
+    output_internal("failed to remove boot session directories\n");
+    return false;
+  }
+  return true;
+}
+
 /* whether an actual config session is associated with this object.
  * the session comes from either the environment or the session ID
  * (see the two different constructors).
@@ -561,6 +764,10 @@ UnionfsCstore::clearCommittedMarkers()
     output_internal("failed to clear committed markers\n");
     return false;
   }
+  committed_markers.clear();
+  committed_markers_ino = 0;
+  committed_markers_off = 0;
+  ++committed_markers_gen;
   return true;
 }
 
@@ -784,6 +991,16 @@ UnionfsCstore::sync_dir(const FsPath& src, const FsPath& dst,
 bool
 UnionfsCstore::commitConfig(commit::PrioNode& node)
 {
+  /* the active config is about to change. note that any interrupted
+   * incremental commit has been recovered when the lock was taken (see
+   * getCommitLock()).
+   */
+  invalidate_active_snapshot();
+  CompCache::invalidate(get_comp_cache_dir());
+  if (getenv(C_ENV_COMMIT_INCREMENTAL.c_str())) {
+    return commit_config_incremental(node);
+  }
+
   FsPath active_unionfs = active_root;
   active_unionfs.push(C_MARKER_UNIONFS);
   
@@ -860,30 +1077,611 @@ UnionfsCstore::commitConfig(commit::PrioNode& node)
   if (path_exists(active_unionfs)) {
     output_internal("failed to remove unionfs directories from active config\n");
   }
+  /* completions may have been cached (under the new generation) while
+   * the commit was running.
+   */
+  CompCache::invalidate(get_comp_cache_dir());
+  // all done. snapshot is optional so ignore failure.
+  write_active_snapshot();
+  return true;
+}
+
+/* boot-time commit (see setupBootSession()). the new active config is
+ * constructed as usual, but since the active config was empty and there is
+ * no union mount, it is simply moved into place. the boot session is then
+ * removed.
+ */
+bool
+UnionfsCstore::commitBootConfig(commit::PrioNode& node)
+{
+  invalidate_active_snapshot();
+  if (!construct_commit_active(node)) {
+    return false;
+  }
+  if (path_exists(tmp_active_root)) {
+    try {
+      b_fs::remove(active_root.path_cstr());
+      b_fs::rename(tmp_active_root.path_cstr(), active_root.path_cstr());
+    } catch (...) {
+      // e.g., not on the same filesystem. copy instead.
+      try {
+        b_fs::create_directories(active_root.path_cstr());
+        recursive_copy_dir(tmp_active_root, active_root, true);
+      } catch (const b_fs::filesystem_error& e) {
+        output_internal("cp ta->a failed[%s]\n", e.what());
+        return false;
+      } catch (...) {
+        output_internal("cp ta->a failed[unknown exception]\n");
+        return false;
+      }
+    }
+  }
+  if (!teardownBootSession()) {
+    return false;
+  }
+  write_active_snapshot();
+  return true;
+}
+
+/* incremental commit.
+ *
+ * instead of regenerating the whole active config, only the "items" (files
+ * or subtrees) that differ between the working config and the active
+ * config are processed. these are found by following the "changed" markers
+ * in the working config, since any change is marked all the way up to the
+ * root (see mark_changed_with_ancestors()).
+ *
+ * the new active content of each item is constructed according to the
+ * outcome of the prio subtrees it falls under (in the same way as
+ * construct_commit_active() does for the whole tree) and staged in the
+ * journal. the journal is then committed by writing the list of items,
+ * and only after that is the active config modified. if the process dies
+ * while the active config is being modified, the journal is replayed by
+ * the next commit (see recover_commit_journal()).
+ */
+bool
+UnionfsCstore::commit_config_incremental(commit::PrioNode& node)
+{
+  FsPath active_unionfs = active_root;
+  active_unionfs.push(C_MARKER_UNIONFS);
+  FsPath jroot = get_journal_root();
+  FsPath stage = jroot;
+  stage.push(C_JOURNAL_STAGE_DIR);
+  FsPath ops_file = jroot;
+  ops_file.push(C_JOURNAL_OPS_FILE);
+
+  vector<commit::PrioNode *> plist;
+  vector<string> ppaths;
+  get_commit_prio_paths(node, plist, ppaths);
+
+  vector<FsPath> items;
+  if (!get_commit_items(FsPath(), items)) {
+    return false;
+  }
+
+  try {
+    if (path_exists(jroot)) {
+      b_fs::remove_all(jroot.path_cstr());
+    }
+    if (path_exists(tmp_work_root)) {
+      b_fs::remove_all(tmp_work_root.path_cstr());
+    }
+    b_fs::create_directories(stage.path_cstr());
+    b_fs::create_directories(tmp_work_root.path_cstr());
+
+    string ops;
+    for (size_t i = 0; i < items.size(); i++) {
+      // save working version so that uncommitted changes can be restored
+      FsPath wp = work_root / items[i];
+      if (path_exists(wp)) {
+        copy_commit_item(wp, tmp_work_root / items[i]);
+      }
+      if (!stage_commit_item(items[i], stage, plist, ppaths)) {
+        return false;
+      }
+      ops += items[i].path_cstr();
+      ops.push_back(0);
+    }
+
+    // commit the journal
+    FsPath tmp_ops = ops_file;
+    tmp_ops.pop();
+    tmp_ops.push(C_JOURNAL_OPS_FILE + ".tmp");
+    int fd = open(tmp_ops.path_cstr(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      output_internal("failed to create commit journal\n");
+      return false;
+    }
+    bool ok = (write(fd, ops.data(), ops.length())
+               == static_cast<ssize_t>(ops.length()));
+    ok = (fsync(fd) == 0 && ok);
+    ok = (close(fd) == 0 && ok);
+    sync();
+    if (!ok || rename(tmp_ops.path_cstr(), ops_file.path_cstr()) != 0) {
+      output_internal("failed to write commit journal\n");
+      return false;
+    }
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("stage commit failed[%s]\n", e.what());
+    return false;
+  } catch (...) {
+    output_internal("stage commit failed[unknown exception]\n");
+    return false;
+  }
+
+  if (!do_umount(work_root)) {
+    return false;
+  }
+  if (b_fs::remove_all(change_root.path_cstr()) < 1) {
+    output_internal("failed to remove [%s]\n", change_root.path_cstr());
+    return false;
+  }
+  if (!apply_commit_journal()) {
+    return false;
+  }
+  try {
+    b_fs::create_directories(change_root.path_cstr());
+  } catch (...) {
+    output_internal("failed to create [%s]\n", change_root.path_cstr());
+    return false;
+  }
+  if (!do_mount(change_root, active_root, work_root)) {
+    return false;
+  }
+  // restore uncommitted changes in working config
+  for (size_t i = 0; i < items.size(); i++) {
+    if (!sync_commit_item(tmp_work_root / items[i], work_root / items[i])) {
+      return false;
+    }
+  }
+  try {
+    b_fs::remove_all(tmp_work_root.path_cstr());
+    b_fs::remove_all(active_unionfs.path_cstr());
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("rm temp dirs failed[%s]\n", e.what());
+    return false;
+  } catch (...) {
+    output_internal("rm temp dirs failed[unknown exception]\n");
+    return false;
+  }
+  // see commitConfig()
+  CompCache::invalidate(get_comp_cache_dir());
   // all done
+  write_active_snapshot();
   return true;
 }
 
+/* get the prio nodes in pre-order along with their paths (relative to
+ * config root).
+ */
+void
+UnionfsCstore::get_commit_prio_paths(commit::PrioNode& node,
+                                     vector<commit::PrioNode *>& plist,
+                                     vector<string>& ppaths)
+{
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  reset_paths();
+  append_cfg_path(node.getCommitPath());
+  plist.push_back(&node);
+  ppaths.push_back(mutable_cfg_path.path_cstr());
+  for (size_t i = 0; i < node.numChildNodes(); i++) {
+    get_commit_prio_paths(*(node.childAt(i)), plist, ppaths);
+  }
+}
+
+/* get entries of config dir "d" that are carried over into the active
+ * config, i.e., everything except dot files (other than the comment). see
+ * recursive_copy_dir().
+ */
+void
+UnionfsCstore::get_commit_entries(const FsPath& d,
+                                  MapT<string, bool>& entries)
+{
+  if (!path_is_directory(d)) {
+    return;
+  }
+  b_fs::directory_iterator di(d.path_cstr());
+  for (; di != b_fs::directory_iterator(); ++di) {
+    string name = di->path().filename().string();
+    if (name.empty() || (name[0] == '.' && name != C_COMMENT_FILE)) {
+      continue;
+    }
+    entries[name] = true;
+  }
+}
+
+/* find the items under "rel" that differ between the working config and
+ * the active config. only dirs marked "changed" are descended into.
+ */
 bool
-UnionfsCstore::getCommitLock()
+UnionfsCstore::get_commit_items(const FsPath& rel, vector<FsPath>& items)
+{
+  MapT<string, bool> wents, aents;
+  try {
+    get_commit_entries(work_root / rel, wents);
+    get_commit_entries(active_root / rel, aents);
+  } catch (...) {
+    output_internal("failed to read [%s]\n", rel.path_cstr());
+    return false;
+  }
+
+  MapT<string, bool>::iterator it = wents.begin();
+  for (; it != wents.end(); ++it) {
+    FsPath r(rel);
+    r.push(it->first);
+    if (aents.find(it->first) == aents.end()) {
+      // added
+      items.push_back(r);
+      continue;
+    }
+    FsPath wp = work_root / r;
+    FsPath ap = active_root / r;
+    if (path_is_directory(wp) && path_is_directory(ap)) {
+      FsPath marker(wp);
+      marker.push(C_MARKER_CHANGED);
+      if (path_exists(marker) && !get_commit_items(r, items)) {
+        return false;
+      }
+    } else if (path_is_regular(wp) && path_is_regular(ap)) {
+      string wd, ad;
+      if (!read_whole_file(wp, wd) || !read_whole_file(ap, ad) || wd != ad) {
+        items.push_back(r);
+      }
+    } else {
+      // type changed
+      items.push_back(r);
+    }
+  }
+  for (it = aents.begin(); it != aents.end(); ++it) {
+    if (wents.find(it->first) == wents.end()) {
+      // deleted
+      FsPath r(rel);
+      r.push(it->first);
+      items.push_back(r);
+    }
+  }
+  return true;
+}
+
+/* construct the new active content of "item" under "stage". the content
+ * comes from the working or the active config depending on whether the
+ * prio subtree the item falls under succeeded, and any prio subtree under
+ * the item then overrides its own part.
+ */
+bool
+UnionfsCstore::stage_commit_item(const FsPath& item, const FsPath& stage,
+                                 const vector<commit::PrioNode *>& plist,
+                                 const vector<string>& ppaths)
 {
-  int fd;
+  string ip = item.path_cstr();
+  FsPath sroot(stage);
+
+  // find the deepest prio subtree containing the item
+  size_t owner = 0;
+  size_t olen = 0;
+  for (size_t i = 0; i < ppaths.size(); i++) {
+    const string& pp = ppaths[i];
+    if ((pp.empty() || ip == pp
+         || (ip.compare(0, pp.length(), pp) == 0 && ip[pp.length()] == '/'))
+        && (pp.length() >= olen)) {
+      owner = i;
+      olen = pp.length();
+    }
+  }
+
+  FsPath sp = sroot / item;
+  FsPath src = (plist[owner]->succeeded() ? work_root : active_root) / item;
+  if (path_exists(src)) {
+    copy_commit_item(src, sp);
+  }
+
+  // prio subtrees under the item (in pre-order, so parents come first)
+  string pfx = ip + "/";
+  for (size_t i = 0; i < ppaths.size(); i++) {
+    if (ppaths[i].compare(0, pfx.length(), pfx) != 0) {
+      continue;
+    }
+    FsPath rel(ppaths[i]);
+    FsPath tp = sroot / rel;
+    if (path_exists(tp)) {
+      if (b_fs::remove_all(tp.path_cstr()) < 1) {
+        output_internal("rm staged [%s] failed\n", tp.path_cstr());
+        return false;
+      }
+      cnode::CfgNode *c = plist[i]->getCfgNode();
+      if (c && c->isTag()) {
+        FsPath p(tp);
+        p.pop();
+        if (is_directory_empty(p)) {
+          b_fs::remove_all(p.path_cstr());
+        }
+      }
+    }
+    FsPath s = (plist[i]->succeeded() ? work_root : active_root) / rel;
+    if (path_exists(s)) {
+      copy_commit_item(s, tp);
+    }
+  }
+  return true;
+}
+
+// copy a file or a dir (filtered) from config to config
+void
+UnionfsCstore::copy_commit_item(const FsPath& src, const FsPath& dst)
+{
+  if (path_is_directory(src)) {
+    recursive_copy_dir(src, dst, true);
+    return;
+  }
+  FsPath p(dst);
+  p.pop();
+  b_fs::create_directories(p.path_cstr());
+  try {
+    b_fs::copy_file(src.path_cstr(), dst.path_cstr());
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("copy_commit_item failed due to %s in copy_file. Falling back to internal stream_file\n", e.what());
+    stream_file(src.path_cstr(), dst.path_cstr());
+  }
+}
+
+/* make "dst" in the working config the same as "src", marking the changes
+ * (see sync_dir()).
+ */
+bool
+UnionfsCstore::sync_commit_item(const FsPath& src, const FsPath& dst)
+{
+  bool sexists = path_exists(src);
+  bool dexists = path_exists(dst);
+  if (!sexists && !dexists) {
+    return true;
+  }
+  if (sexists && dexists) {
+    if (path_is_directory(src) && path_is_directory(dst)) {
+      return sync_dir(src, dst, work_root);
+    }
+    if (path_is_regular(src) && path_is_regular(dst)) {
+      string ds, dd;
+      if (read_whole_file(src, ds) && read_whole_file(dst, dd) && ds == dd) {
+        return true;
+      }
+    }
+  }
+  try {
+    if (dexists) {
+      b_fs::remove_all(dst.path_cstr());
+    }
+    if (sexists) {
+      copy_commit_item(src, dst);
+    }
+  } catch (...) {
+    output_user("failed to restore [%s]\n", dst.path_cstr());
+    return false;
+  }
+  FsPath p(dst);
+  p.pop();
+  return mark_dir_changed(p, work_root);
+}
+
+void
+UnionfsCstore::invalidate_active_snapshot()
+{
+  string file = get_active_snapshot_file();
+  if (unlink(file.c_str()) != 0 && errno != ENOENT) {
+    output_internal("failed to remove [%s]\n", file.c_str());
+  }
+}
+
+// apply the committed journal to the active config
+bool
+UnionfsCstore::apply_commit_journal()
+{
+  FsPath jroot = get_journal_root();
+  FsPath stage = jroot;
+  stage.push(C_JOURNAL_STAGE_DIR);
+  FsPath ops_file = jroot;
+  ops_file.push(C_JOURNAL_OPS_FILE);
 
-  fd = open(C_COMMIT_LOCK_FILE.c_str(),
-	    O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+  string ops;
+  try {
+    std::ifstream fin(ops_file.path_cstr(), std::ios::binary);
+    std::stringstream ss;
+    ss << fin.rdbuf();
+    ops = ss.str();
+
+    /* each item is replaced as a whole, so this can be repeated if it is
+     * interrupted.
+     */
+    size_t start = 0, end = 0;
+    while ((end = ops.find('\0', start)) != string::npos) {
+      FsPath rel(ops.substr(start, end - start));
+      start = end + 1;
+      FsPath ap = active_root / rel;
+      FsPath sp = stage / rel;
+      if (path_exists(ap)) {
+        b_fs::remove_all(ap.path_cstr());
+      }
+      if (path_exists(sp)) {
+        copy_commit_item(sp, ap);
+      }
+    }
+    sync();
+    b_fs::remove_all(jroot.path_cstr());
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("apply commit journal failed[%s]\n", e.what());
+    return false;
+  } catch (...) {
+    output_internal("apply commit journal failed[unknown exception]\n");
+    return false;
+  }
+  return true;
+}
+
+/* if an incremental commit was interrupted after its journal had been
+ * committed, replay the journal. otherwise the active config has not been
+ * modified, so just discard the journal. must be called with the commit
+ * lock held (see getCommitLock() and check_active_journal()).
+ */
+bool
+UnionfsCstore::recover_commit_journal()
+{
+  FsPath jroot = get_journal_root();
+  if (!path_exists(jroot)) {
+    return true;
+  }
+  FsPath ops_file = jroot;
+  ops_file.push(C_JOURNAL_OPS_FILE);
+  if (path_exists(ops_file)) {
+    output_internal("replaying commit journal [%s]\n", jroot.path_cstr());
+    return apply_commit_journal();
+  }
+  try {
+    b_fs::remove_all(jroot.path_cstr());
+  } catch (...) {
+    output_internal("failed to remove [%s]\n", jroot.path_cstr());
+    return false;
+  }
+  return true;
+}
+
+// fd of the commit lock if it is held by this process
+static int _commit_lock_fd = -1;
+
+static int
+_try_commit_lock(const string& lock_file)
+{
+  int fd = open(lock_file.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
   if (fd < 0) {
+    return -2;
+  }
+  if (lockf(fd, F_TLOCK, 0) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* note: an interrupted incremental commit is recovered here, i.e., before
+ * the commit reads the active config.
+ */
+bool
+UnionfsCstore::getCommitLock()
+{
+  int fd = _try_commit_lock(C_COMMIT_LOCK_FILE);
+  if (fd == -2) {
     // should not happen since all commit processes should have write access
     output_internal("getCommitLock() failed to open lock file\n");
     return false;
   }
-  if (lockf(fd, F_TLOCK, 0) < 0) {
+  if (fd < 0) {
     // locked by someone else
     return false;
   }
   // got the lock
+  _commit_lock_fd = fd;
+  if (!recover_commit_journal()) {
+    output_user("Failed to recover from an interrupted commit\n");
+    return false;
+  }
   return true;
 }
 
+/* make sure the active config is not half-applied by an incremental commit
+ * before reading it. if a commit was interrupted, recover it (taking the
+ * commit lock briefly). if a commit is applying its journal, wait for it
+ * to finish. returns false if the active config is still inconsistent.
+ */
+bool
+UnionfsCstore::check_active_journal()
+{
+  if (active_journal_checked || _commit_lock_fd >= 0) {
+    // checked already, or this process is committing (see getCommitLock())
+    return true;
+  }
+  FsPath ops_file = get_journal_root();
+  ops_file.push(C_JOURNAL_OPS_FILE);
+  for (unsigned int ms = 0; path_exists(ops_file); ms += 100) {
+    int fd = _try_commit_lock(C_COMMIT_LOCK_FILE);
+    if (fd >= 0) {
+      bool ret = recover_commit_journal();
+      // this process did not hold the lock, so this releases it
+      close(fd);
+      if (!ret) {
+        return false;
+      }
+      break;
+    }
+    if (fd == -2 || ms >= C_JOURNAL_WAIT_MS) {
+      return false;
+    }
+    usleep(100000);
+  }
+  active_journal_checked = true;
+  return true;
+}
+
+/* compile all templates under the template root into the template
+ * database. this should be done whenever templates are installed.
+ */
+bool
+UnionfsCstore::compileTemplates()
+{
+  const char *db = getenv(C_ENV_TMPL_DB.c_str());
+  string db_file = (db ? db : C_DEF_TMPL_DB);
+  if (!TmplDb::build(tmpl_root.path_cstr(), db_file)) {
+    output_internal("failed to compile templates into [%s]\n",
+                    db_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+// the stamp is the identity and mtime of the template database
+bool
+UnionfsCstore::getTmplStamp(string& stamp)
+{
+  const char *db = getenv(C_ENV_TMPL_DB.c_str());
+  string db_file = (db ? db : C_DEF_TMPL_DB);
+  struct stat st;
+  if (stat(db_file.c_str(), &st) != 0) {
+    return false;
+  }
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%llu:%llu:%lld.%09ld",
+           static_cast<unsigned long long>(st.st_dev),
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec);
+  stamp = buf;
+  return true;
+}
+
+/* the snapshot is next to the active root, and the stamp is the identity
+ * and mtime of the active root. the latter is only a safety net: anything
+ * that modifies the active config (i.e., commit) removes the snapshot
+ * first (see invalidate_active_snapshot()).
+ */
+bool
+UnionfsCstore::getActiveSnapshotInfo(string& file, string& stamp)
+{
+  if (!check_active_journal()) {
+    return false;
+  }
+  struct stat st;
+  if (stat(active_root.path_cstr(), &st) != 0) {
+    return false;
+  }
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%llu:%llu:%lld.%09ld",
+           static_cast<unsigned long long>(st.st_dev),
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec);
+  file = get_active_snapshot_file();
+  stamp = buf;
+  return true;
+}
 
 ////// virtual functions defined in base class
 /* check if current tmpl_path is a valid tmpl dir.
@@ -892,21 +1690,48 @@ UnionfsCstore::getCommitLock()
 bool
 UnionfsCstore::tmpl_node_exists()
 {
-  return (path_exists(tmpl_path) && path_is_directory(tmpl_path));
+  bool in_trie;
+  if (get_tmpl_trie_node(in_trie)) {
+    return true;
+  }
+  return (!in_trie && path_exists(tmpl_path)
+          && path_is_directory(tmpl_path));
+}
+
+void
+UnionfsCstore::get_all_tmpl_child_node_names(vector<string>& cnodes)
+{
+  bool in_trie;
+  TmplTrieNode *node = get_tmpl_trie_node(in_trie);
+  if (node) {
+    const vector<string>& names = node->getNodeNames();
+    cnodes.insert(cnodes.end(), names.begin(), names.end());
+  } else if (!in_trie) {
+    get_all_child_dir_names(tmpl_path, cnodes);
+  }
 }
 
 typedef MapT<FsPath, tr1::shared_ptr<vtw_def>, FsPathHash> ParsedTmplCacheT;
 static ParsedTmplCacheT _parsed_tmpl_cache;
+static TmplDb _tmpl_db;
 
 /* parse template at current tmpl_path and return an allocated Ctemplate
  * pointer if successful. otherwise return 0.
+ *
+ * templates are looked up in the process-local cache first, then in the
+ * compiled template database. only if neither has an up-to-date entry is
+ * the node.def actually parsed.
  */
 Ctemplate *
 UnionfsCstore::tmpl_parse()
 {
   FsPath tp = tmpl_path;
   tp.push(C_DEF_NAME);
-  if (!path_exists(tp) || !path_is_regular(tp)) {
+  struct stat st;
+  bool in_trie;
+  TmplTrieNode *node = get_tmpl_trie_node(in_trie);
+  if (in_trie ? (!node || !node->getDef(st))
+      : (stat(tp.path_cstr(), &st) != 0 || !S_ISREG(st.st_mode))) {
     // invalid
     return 0;
   }
@@ -917,8 +1742,19 @@ UnionfsCstore::tmpl_parse()
     return (new Ctemplate(p->second));
   }
 
+  if (!_tmpl_db.initialized()) {
+    const char *db = getenv(C_ENV_TMPL_DB.c_str());
+    _tmpl_db.open(db ? db : C_DEF_TMPL_DB);
+  }
+  tr1::shared_ptr<vtw_def> def(_tmpl_db.lookup(tp.path_cstr(), st));
+  if (def.get()) {
+    // found in compiled database => cache and return
+    _parsed_tmpl_cache[tp] = def;
+    return (new Ctemplate(def));
+  }
+
   // new template => parse
-  tr1::shared_ptr<vtw_def> def(new vtw_def);
+  def.reset(new vtw_def);
   vtw_def *_def = def.get();
   if (_def && parse_def(_def, tp.path_cstr(), 0) == 0) {
     // succes => cache and return
@@ -1003,6 +1839,33 @@ UnionfsCstore::get_all_child_node_names_impl(vector<string>& cnodes,
    */
 }
 
+// same as above but without building the list
+void
+UnionfsCstore::for_each_child_node_name_impl(ChildNodeFuncT func, void *arg,
+                                             bool active_cfg)
+{
+  FsPath p = (active_cfg ? get_active_path() : get_work_path());
+  if (!path_exists(p) || !path_is_directory(p)) {
+    return;
+  }
+  try {
+    b_fs::directory_iterator di(p.path_cstr());
+    for (; di != b_fs::directory_iterator(); ++di) {
+      // same filtering as check_dir_entries()
+      string cname = di->path().filename().string();
+      if (cname.length() < 1 || cname[0] == '.'
+          || !path_is_directory(di->path().string().c_str())) {
+        continue;
+      }
+      if (!func(_unescape_path_name(cname).c_str(), arg)) {
+        break;
+      }
+    }
+  } catch (...) {
+    // skip the rest
+  }
+}
+
 bool
 UnionfsCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
 {
@@ -1258,6 +2121,9 @@ UnionfsCstore::unmark_deactivated_descendants()
 bool
 UnionfsCstore::mark_changed_with_ancestors()
 {
+  // working config is being modified
+  CompCache::invalidate(get_comp_cache_dir());
+
   FsPath opath = mutable_cfg_path; // use a copy
   bool done = false;
   while (!done) {
@@ -1347,6 +2213,7 @@ UnionfsCstore::discard_changes(unsigned long long& num_removed)
   // need to keep unsaved marker
   bool unsaved = sessionUnsaved();
   bool ret = true;
+  CompCache::invalidate(get_comp_cache_dir());
 
   vector<b_fs::path> files;
   vector<b_fs::path> directories;
@@ -1421,7 +2288,8 @@ UnionfsCstore::marked_committed(bool is_delete)
 {
   string marker;
   get_committed_marker(is_delete, marker);
-  return find_line_in_file(commit_marker_file, marker);
+  sync_committed_markers();
+  return (committed_markers.find(marker) != committed_markers.end());
 }
 
 bool
@@ -1430,7 +2298,12 @@ UnionfsCstore::mark_committed(bool is_delete)
   string marker;
   get_committed_marker(is_delete, marker);
   // write one marker per line
-  return write_file(commit_marker_file, marker + "\n", true);
+  if (!write_file(commit_marker_file, marker + "\n", true)) {
+    return false;
+  }
+  committed_markers[marker] = true;
+  ++committed_markers_gen;
+  return true;
 }
 
 string
@@ -1455,6 +2328,52 @@ UnionfsCstore::tmpl_path_to_str() {
 
 
 ////// private functions
+void
+UnionfsCstore::push_tmpl_path(const char *new_comp)
+{
+  string comp = _escape_path_name(new_comp);
+  tmpl_path.push(comp);
+  tmpl_trie_push(comp);
+}
+
+void
+UnionfsCstore::tmpl_trie_push(const string& comp)
+{
+  if (tmpl_trie_nodes.empty()) {
+    // not known. will be looked up when needed.
+    return;
+  }
+  TmplTrieNode *node = tmpl_trie_nodes.back();
+  tmpl_trie_nodes.push_back(node ? node->getChild(comp) : NULL);
+}
+
+void
+UnionfsCstore::tmpl_trie_pop()
+{
+  /* if this empties it (i.e., popped the template root), it will be looked
+   * up when needed.
+   */
+  if (!tmpl_trie_nodes.empty()) {
+    tmpl_trie_nodes.pop_back();
+  }
+}
+
+/* return the trie node for the current tmpl_path. return NULL if it is not
+ * a template dir, and set "in_trie" to false if it cannot be handled by the
+ * trie (see _get_tmpl_trie_nodes()).
+ */
+TmplTrieNode *
+UnionfsCstore::get_tmpl_trie_node(bool& in_trie)
+{
+  if (tmpl_trie_nodes.empty()
+      && !_get_tmpl_trie_nodes(tmpl_root, tmpl_path, tmpl_trie_nodes)) {
+    in_trie = false;
+    return NULL;
+  }
+  in_trie = true;
+  return tmpl_trie_nodes.back();
+}
+
 void
 UnionfsCstore::push_path(FsPath& old_path, const char *new_comp)
 {
@@ -1621,25 +2540,53 @@ UnionfsCstore::get_committed_marker(bool is_delete, string& marker)
   marker += mutable_cfg_path.path_cstr();
 }
 
-bool
-UnionfsCstore::find_line_in_file(const FsPath& file, const string& line)
+/* bring the committed marker set up to date with the marker file. the
+ * file is only appended to during a commit, so only the part that has not
+ * been seen yet is read. if the file has been removed or replaced, start
+ * over.
+ */
+void
+UnionfsCstore::sync_committed_markers()
 {
-  bool ret = false;
+  struct stat st;
+  if (stat(commit_marker_file.path_cstr(), &st) != 0) {
+    // no markers
+    if (!committed_markers.empty()) {
+      committed_markers.clear();
+      ++committed_markers_gen;
+    }
+    committed_markers_ino = 0;
+    committed_markers_off = 0;
+    return;
+  }
+  if (st.st_ino != committed_markers_ino
+      || st.st_size < committed_markers_off) {
+    committed_markers.clear();
+    committed_markers_ino = st.st_ino;
+    committed_markers_off = 0;
+    ++committed_markers_gen;
+  }
+  if (st.st_size == committed_markers_off) {
+    // nothing new
+    return;
+  }
   try {
-    std::ifstream fin(file.path_cstr());
-    while (!fin.eof() && !fin.bad() && !fin.fail()) {
-      string in;
-      getline(fin, in);
-      if (in == line) {
-        ret = true;
+    std::ifstream fin(commit_marker_file.path_cstr());
+    fin.seekg(committed_markers_off);
+    string in;
+    while (getline(fin, in)) {
+      if (fin.eof()) {
+        // incomplete line. leave it for next time.
         break;
       }
+      committed_markers[in] = true;
+      committed_markers_off += (in.length() + 1);
+      ++committed_markers_gen;
     }
     fin.close();
   } catch (...) {
-    ret = false;
+    // leave the set as is
   }
-  return ret;
 }
 
 bool
@@ -42,7 +42,10 @@ namespace unionfs { // begin namespace unionfs
 namespace b_fs = boost::filesystem;
 namespace b_s = boost::system;
 
+class TmplTrieNode;
+
 class UnionfsCstore : public Cstore {
+  friend class TmplTrieNode;
 public:
   UnionfsCstore(bool use_edit_level);
   UnionfsCstore(const string& session_id, string& env);
@@ -56,9 +59,15 @@ public:
   bool setupSession();
   bool teardownSession();
   bool inSession();
+  bool setupBootSession();
+  bool teardownBootSession();
   bool clearCommittedMarkers();
   bool commitConfig(commit::PrioNode& pnode);
+  bool commitBootConfig(commit::PrioNode& pnode);
   bool getCommitLock();
+  bool compileTemplates();
+  bool getTmplStamp(string& stamp);
+  bool getActiveSnapshotInfo(string& file, string& stamp);
 
 private:
   // constants
@@ -67,8 +76,11 @@ private:
   static const string C_ENV_ACTIVE_ROOT;
   static const string C_ENV_CHANGE_ROOT;
   static const string C_ENV_TMP_ROOT;
+  static const string C_ENV_TMPL_DB;
+  static const string C_ENV_COMMIT_INCREMENTAL;
 
   static const string C_DEF_TMPL_ROOT;
+  static const string C_DEF_TMPL_DB;
   static const string C_DEF_CFG_ROOT;
   static const string C_DEF_ACTIVE_ROOT;
   static const string C_DEF_CHANGE_PREFIX;
@@ -81,16 +93,23 @@ private:
   static const string C_MARKER_UNSAVED;
   static const string C_MARKER_UNIONFS;
   static const string C_COMMITTED_MARKER_FILE;
+  static const string C_COMP_CACHE_DIR;
   static const string C_COMMENT_FILE;
   static const string C_TAG_NAME;
   static const string C_VAL_NAME;
   static const string C_DEF_NAME;
   static const string C_COMMIT_LOCK_FILE;
+  static const string C_JOURNAL_SUFFIX;
+  static const string C_JOURNAL_OPS_FILE;
+  static const string C_JOURNAL_STAGE_DIR;
+  static const string C_SNAPSHOT_SUFFIX;
 
   /* max size for a file.
    * currently this includes value file and comment file.
    */
   static const size_t C_UNIONFS_MAX_FILE_SIZE = 262144;
+  // how long to wait for a commit to finish applying its journal
+  static const unsigned int C_JOURNAL_WAIT_MS = 30000;
 
   // root dirs (constant)
   FsPath work_root;   // working root (union)
@@ -104,12 +123,33 @@ private:
   FsPath tmpl_path;         // whole template path
   FsPath orig_mutable_cfg_path;  // original mutable cfg path
   FsPath orig_tmpl_path;         // original template path
+  /* trie nodes of tmpl_path and its ancestors (see TmplTrieNode), kept in
+   * step with tmpl_path. empty if not known, e.g., after tmpl_path is
+   * assigned.
+   */
+  vector<TmplTrieNode *> tmpl_trie_nodes;
+  void tmpl_trie_push(const string& comp);
+  void tmpl_trie_pop();
+  TmplTrieNode *get_tmpl_trie_node(bool& in_trie);
 
   // for commit processing
   FsPath tmp_active_root;
   FsPath tmp_work_root;
   FsPath commit_marker_file;
+  /* committed markers are kept in a hashed set in memory. the marker file
+   * is still appended to (other processes, e.g., scripts invoked during
+   * commit, check the markers too), and the set is brought up to date by
+   * reading only what has been appended since the last check.
+   */
+  MapT<string, bool> committed_markers;
+  ino_t committed_markers_ino;
+  off_t committed_markers_off;
+  unsigned long long committed_markers_gen; // bumped when the set changes
   void init_commit_data() {
+    committed_markers.clear();
+    committed_markers_ino = 0;
+    committed_markers_off = 0;
+    committed_markers_gen = 0;
     tmp_active_root = tmp_root;
     tmp_work_root = tmp_root;
     commit_marker_file = tmp_root;
@@ -118,14 +158,40 @@ private:
     commit_marker_file.push(C_COMMITTED_MARKER_FILE);
   }
   bool construct_commit_active(commit::PrioNode& node);
+
+  // for incremental commit
+  FsPath get_journal_root() {
+    string j = active_root.path_cstr();
+    j += C_JOURNAL_SUFFIX;
+    return FsPath(j);
+  };
+  string get_active_snapshot_file() {
+    string s = active_root.path_cstr();
+    s += C_SNAPSHOT_SUFFIX;
+    return s;
+  };
+  void invalidate_active_snapshot();
+  bool active_journal_checked; // see check_active_journal()
+  bool check_active_journal();
+  bool commit_config_incremental(commit::PrioNode& node);
+  void get_commit_prio_paths(commit::PrioNode& node,
+                             vector<commit::PrioNode *>& plist,
+                             vector<string>& ppaths);
+  bool get_commit_items(const FsPath& rel, vector<FsPath>& items);
+  void get_commit_entries(const FsPath& d, MapT<string, bool>& entries);
+  bool stage_commit_item(const FsPath& item, const FsPath& stage,
+                         const vector<commit::PrioNode *>& plist,
+                         const vector<string>& ppaths);
+  void copy_commit_item(const FsPath& src, const FsPath& dst);
+  bool sync_commit_item(const FsPath& src, const FsPath& dst);
+  bool apply_commit_journal();
+  bool recover_commit_journal();
   bool mark_dir_changed(const FsPath& d, const FsPath& root);
   bool sync_dir(const FsPath& src, const FsPath& dst, const FsPath& root);
 
   ////// virtual functions defined in base class
   // begin path modifiers
-  void push_tmpl_path(const char *new_comp) {
-    push_path(tmpl_path, new_comp);
-  };
+  void push_tmpl_path(const char *new_comp);
   void push_tmpl_path_tag() {
     /* not using push_path => not "escaped".
      * NOTE: this is the only interface that can push tmpl_path "unescaped".
@@ -135,12 +201,15 @@ private:
      *       sequences, this cannot happen for now.
      */
     tmpl_path.push(C_TAG_NAME);
+    tmpl_trie_push(C_TAG_NAME);
   };
   void pop_tmpl_path() {
     pop_path(tmpl_path);
+    tmpl_trie_pop();
   };
   void pop_tmpl_path(string& last) {
     pop_path(tmpl_path, last);
+    tmpl_trie_pop();
   };
   void push_cfg_path(const char *new_comp) {
     push_path(mutable_cfg_path, new_comp);
@@ -169,22 +238,26 @@ private:
       tmpl_path = orig_tmpl_path;
       mutable_cfg_path = orig_mutable_cfg_path;
     }
+    tmpl_trie_nodes.clear();
   };
 
   class UnionfsSavePaths : public SavePaths {
   public:
     UnionfsSavePaths(UnionfsCstore *cs)
-      : cstore(cs), cpath(cs->mutable_cfg_path), tpath(cs->tmpl_path) {};
+      : cstore(cs), cpath(cs->mutable_cfg_path), tpath(cs->tmpl_path),
+        tnodes(cs->tmpl_trie_nodes) {};
 
     ~UnionfsSavePaths() {
       cstore->mutable_cfg_path = cpath;
       cstore->tmpl_path = tpath;
+      cstore->tmpl_trie_nodes = tnodes;
     };
 
   private:
     UnionfsCstore *cstore;
     FsPath cpath;
     FsPath tpath;
+    vector<TmplTrieNode *> tnodes;
   };
   #if __GNUC__ < 6
   auto_ptr<SavePaths> create_save_paths() {
@@ -212,9 +285,9 @@ private:
   bool add_node();
   bool remove_node();
   void get_all_child_node_names_impl(vector<string>& cnodes, bool active_cfg);
-  void get_all_tmpl_child_node_names(vector<string>& cnodes) {
-    get_all_child_dir_names(tmpl_path, cnodes);
-  };
+  void for_each_child_node_name_impl(ChildNodeFuncT func, void *arg,
+                                     bool active_cfg);
+  void get_all_tmpl_child_node_names(vector<string>& cnodes);
   bool write_value_vec(const vector<string>& vvec, bool active_cfg);
   bool rename_child_node(const char *oname, const char *nname);
   bool copy_child_node(const char *oname, const char *nname);
@@ -252,9 +325,19 @@ private:
     return cfg_path_at_root();
   };
 
+  string get_comp_cache_dir() {
+    FsPath d = tmp_root;
+    d.push(C_COMP_CACHE_DIR);
+    return d.path_cstr();
+  };
+
   // functions for commit operation
   bool marked_committed(bool is_delete);
   bool mark_committed(bool is_delete);
+  unsigned long long get_committed_markers_gen() {
+    sync_committed_markers();
+    return committed_markers_gen;
+  };
 
   // for testing/debugging
   string cfg_path_to_str();
@@ -262,7 +345,12 @@ private:
 
   ////// private functions
   FsPath get_work_path() { return (work_root / mutable_cfg_path); };
-  FsPath get_active_path() { return (active_root / mutable_cfg_path); };
+  FsPath get_active_path() {
+    if (!check_active_journal()) {
+      exit_internal("active config is being updated by another commit\n");
+    }
+    return (active_root / mutable_cfg_path);
+  };
   FsPath get_change_path() { return (change_root / mutable_cfg_path); };
   void push_path(FsPath& old_path, const char *new_comp);
   void pop_path(FsPath& path);
@@ -291,7 +379,7 @@ private:
   void recursive_copy_dir(const FsPath& src, const FsPath& dst,
                           bool filter_dot_entries = false);
   void get_committed_marker(bool is_delete, string& marker);
-  bool find_line_in_file(const FsPath& file, const string& line);
+  void sync_committed_markers();
   bool do_mount(const FsPath& rwdir, const FsPath& rdir, const FsPath& mdir);
   bool do_umount(const FsPath& mdir);
 
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include <cli_cstore.h>
+#include <cstore/unionfs/tmpl-db.hpp>
+
+namespace cstore { // begin namespace cstore
+namespace unionfs { // begin namespace unionfs
+
+using namespace std;
+
+const char TmplDb::C_DB_MAGIC[8] = { 'V', 'Y', 'T', 'M', 'P', 'L', 'D', 'B' };
+
+////// record encoding
+/* a record is a flat byte stream: integers are 32-bit native-endian, and
+ * a string is its length plus one (0 means NULL) followed by the bytes
+ * including the terminating NUL, so that it can be used in place.
+ */
+static void
+_put_u32(string& out, uint32_t v)
+{
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void
+_put_str(string& out, const char *s)
+{
+  if (!s) {
+    _put_u32(out, 0);
+    return;
+  }
+  size_t len = strlen(s);
+  _put_u32(out, len + 1);
+  out.append(s, len + 1);
+}
+
+static void
+_put_node(string& out, const vtw_node *node)
+{
+  if (!node) {
+    _put_u32(out, 0);
+    return;
+  }
+  _put_u32(out, 1);
+  _put_u32(out, node->vtw_node_oper);
+  _put_u32(out, node->vtw_node_aux);
+  _put_u32(out, node->vtw_node_type);
+  _put_str(out, node->vtw_node_string);
+
+  const valstruct& v = node->vtw_node_val;
+  _put_u32(out, v.val_type);
+  _put_str(out, v.val);
+  _put_u32(out, (v.cnt > 0 && v.vals) ? v.cnt : 0);
+  if (v.cnt > 0 && v.vals) {
+    for (int i = 0; i < v.cnt; i++) {
+      _put_str(out, v.vals[i]);
+    }
+    _put_u32(out, (v.val_types ? 1 : 0));
+    if (v.val_types) {
+      for (int i = 0; i < v.cnt; i++) {
+        _put_u32(out, v.val_types[i]);
+      }
+    }
+  }
+
+  _put_node(out, node->vtw_node_left);
+  _put_node(out, node->vtw_node_right);
+}
+
+static void
+_put_def(string& out, const vtw_def *def)
+{
+  _put_u32(out, def->def_type);
+  _put_u32(out, def->def_type2);
+  _put_str(out, def->def_type_help);
+  _put_str(out, def->def_node_help);
+  _put_str(out, def->def_default);
+  _put_u32(out, def->def_priority);
+  _put_str(out, def->def_priority_ext);
+  _put_str(out, def->def_enumeration);
+  _put_str(out, def->def_comp_help);
+  _put_str(out, def->def_allowed);
+  _put_str(out, def->def_val_help);
+  _put_u32(out, def->def_tag);
+  _put_u32(out, def->def_multi);
+  _put_u32(out, def->tag);
+  _put_u32(out, def->multi);
+  for (int i = 0; i < top_act; i++) {
+    _put_node(out, def->actions[i].vtw_list_head);
+  }
+}
+
+/* decoder for the above. strings are returned as pointers into the
+ * record. any out-of-bounds read marks the reader as failed.
+ */
+class RecReader {
+public:
+  RecReader(char *p, size_t len) : _p(p), _end(p + len), _ok(true) {};
+
+  bool ok() const { return _ok; };
+  uint32_t u32() {
+    uint32_t v = 0;
+    if (!_ok || static_cast<size_t>(_end - _p) < sizeof(v)) {
+      _ok = false;
+      return 0;
+    }
+    memcpy(&v, _p, sizeof(v));
+    _p += sizeof(v);
+    return v;
+  };
+  char *str() {
+    uint32_t len = u32();
+    if (!_ok || len == 0) {
+      return 0;
+    }
+    if (static_cast<size_t>(_end - _p) < len || _p[len - 1] != 0) {
+      _ok = false;
+      return 0;
+    }
+    char *s = _p;
+    _p += len;
+    return s;
+  };
+
+private:
+  char *_p;
+  char *_end;
+  bool _ok;
+};
+
+static vtw_node *
+_get_node(RecReader& r)
+{
+  if (r.u32() == 0 || !r.ok()) {
+    return 0;
+  }
+  vtw_node *node = static_cast<vtw_node *>(calloc(1, sizeof(vtw_node)));
+  if (!node) {
+    return 0;
+  }
+  node->vtw_node_oper = static_cast<vtw_oper_e>(r.u32());
+  node->vtw_node_aux = r.u32();
+  node->vtw_node_type = static_cast<vtw_type_e>(r.u32());
+  node->vtw_node_string = r.str();
+
+  valstruct& v = node->vtw_node_val;
+  v.val_type = static_cast<vtw_type_e>(r.u32());
+  v.val = r.str();
+  v.cnt = r.u32();
+  if (v.cnt > 0 && r.ok()) {
+    v.vals = static_cast<char **>(calloc(v.cnt, sizeof(char *)));
+    for (int i = 0; v.vals && i < v.cnt; i++) {
+      v.vals[i] = r.str();
+    }
+    if (r.u32() && r.ok()) {
+      v.val_types = static_cast<vtw_type_e *>(calloc(v.cnt,
+                                                     sizeof(vtw_type_e)));
+      for (int i = 0; v.val_types && i < v.cnt; i++) {
+        v.val_types[i] = static_cast<vtw_type_e>(r.u32());
+      }
+    }
+  }
+  // strings belong to the mapping
+  v.free_me = 0;
+
+  node->vtw_node_left = _get_node(r);
+  node->vtw_node_right = _get_node(r);
+  return node;
+}
+
+static bool
+_get_def(RecReader& r, vtw_def *def)
+{
+  memset(def, 0, sizeof(vtw_def));
+  def->def_type = static_cast<vtw_type_e>(r.u32());
+  def->def_type2 = static_cast<vtw_type_e>(r.u32());
+  def->def_type_help = r.str();
+  def->def_node_help = r.str();
+  def->def_default = r.str();
+  def->def_priority = r.u32();
+  def->def_priority_ext = r.str();
+  def->def_enumeration = r.str();
+  def->def_comp_help = r.str();
+  def->def_allowed = r.str();
+  def->def_val_help = r.str();
+  def->def_tag = r.u32();
+  def->def_multi = r.u32();
+  def->tag = r.u32();
+  def->multi = r.u32();
+  for (int i = 0; i < top_act; i++) {
+    vtw_list& l = def->actions[i];
+    l.vtw_list_head = _get_node(r);
+    // the list tail is the last node of the LIST_OP chain
+    for (vtw_node *n = l.vtw_list_head; n; n = n->vtw_node_right) {
+      l.vtw_list_tail = n;
+    }
+  }
+  return r.ok();
+}
+
+////// public functions
+TmplDb::~TmplDb()
+{
+  /* the mapping is intentionally kept until process exit since templates
+   * that have been returned by lookup() point into it.
+   */
+}
+
+bool
+TmplDb::open(const string& db_file)
+{
+  _init = true;
+  int fd = ::open(db_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || static_cast<size_t>(st.st_size) < sizeof(DbHeader)) {
+    close(fd);
+    return false;
+  }
+  /* map privately and writable: some evaluation code temporarily modifies
+   * template strings in place, which must not reach the file.
+   */
+  void *m = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    return false;
+  }
+  _map = static_cast<char *>(m);
+  _map_len = st.st_size;
+
+  const DbHeader *hdr = reinterpret_cast<const DbHeader *>(_map);
+  if (memcmp(hdr->magic, C_DB_MAGIC, sizeof(C_DB_MAGIC)) != 0
+      || hdr->version != C_DB_VERSION
+      || hdr->index_off > _map_len
+      || (_map_len - hdr->index_off) / sizeof(DbEntry) < hdr->num_entries
+      || hdr->index_off % sizeof(uint64_t) != 0) {
+    // not a valid database
+    munmap(_map, _map_len);
+    _map = 0;
+    _map_len = 0;
+    return false;
+  }
+  _num_entries = hdr->num_entries;
+  _entries = reinterpret_cast<const DbEntry *>(_map + hdr->index_off);
+  return true;
+}
+
+vtw_def *
+TmplDb::lookup(const char *def_file, const struct stat& st)
+{
+  const DbEntry *e = find_entry(def_file);
+  if (!e || e->size != st.st_size || e->mtime_sec != st.st_mtim.tv_sec
+      || e->mtime_nsec != st.st_mtim.tv_nsec) {
+    // not found or stale
+    return 0;
+  }
+  if (e->rec_off > _map_len || e->rec_len > _map_len - e->rec_off) {
+    return 0;
+  }
+  RecReader r(_map + e->rec_off, e->rec_len);
+  vtw_def *def = new vtw_def;
+  if (!_get_def(r, def)) {
+    /* corrupted record. the partially decoded nodes are leaked, same as
+     * any template that is never freed.
+     */
+    delete def;
+    return 0;
+  }
+  return def;
+}
+
+const TmplDb::DbEntry *
+TmplDb::find_entry(const char *def_file)
+{
+  if (!_map) {
+    return 0;
+  }
+  // entries are sorted by path
+  size_t lo = 0, hi = _num_entries;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const DbEntry *e = &(_entries[mid]);
+    if (e->path_off > _map_len || e->path_len >= _map_len - e->path_off) {
+      return 0;
+    }
+    int c = strcmp(def_file, _map + e->path_off);
+    if (c == 0) {
+      return e;
+    } else if (c < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return 0;
+}
+
+////// database construction
+struct BuildEntry {
+  string path;
+  struct stat st;
+  string rec;
+  bool operator<(const BuildEntry& rhs) const {
+    return (strcmp(path.c_str(), rhs.path.c_str()) < 0);
+  };
+};
+
+static void
+_collect_tmpls(const string& dir, vector<BuildEntry>& entries)
+{
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    string p = dir + "/" + de->d_name;
+    struct stat st;
+    if (stat(p.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      _collect_tmpls(p, entries);
+    } else if (S_ISREG(st.st_mode) && strcmp(de->d_name, "node.def") == 0) {
+      vtw_def def;
+      if (parse_def(&def, p.c_str(), 0) != 0) {
+        // leave it to be parsed (and reported) at run time
+        continue;
+      }
+      BuildEntry e;
+      e.path = p;
+      e.st = st;
+      _put_def(e.rec, &def);
+      entries.push_back(e);
+    }
+  }
+  closedir(d);
+}
+
+static bool
+_write_all(FILE *f, const void *data, size_t len)
+{
+  return (len == 0 || fwrite(data, len, 1, f) == 1);
+}
+
+bool
+TmplDb::build(const string& tmpl_root, const string& db_file)
+{
+  vector<BuildEntry> entries;
+  _collect_tmpls(tmpl_root, entries);
+  sort(entries.begin(), entries.end());
+
+  char pid_str[16];
+  snprintf(pid_str, sizeof(pid_str), "%u", getpid());
+  string tmp_file = db_file + ".tmp." + pid_str;
+  FILE *f = fopen(tmp_file.c_str(), "w");
+  if (!f) {
+    return false;
+  }
+
+  DbHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, C_DB_MAGIC, sizeof(C_DB_MAGIC));
+  hdr.version = C_DB_VERSION;
+  hdr.num_entries = entries.size();
+
+  bool ret = _write_all(f, &hdr, sizeof(hdr));
+  vector<DbEntry> index;
+  uint64_t off = sizeof(hdr);
+  for (size_t i = 0; ret && i < entries.size(); i++) {
+    const BuildEntry& be = entries[i];
+    DbEntry e;
+    memset(&e, 0, sizeof(e));
+    e.path_off = off;
+    e.path_len = be.path.length();
+    e.rec_off = off + be.path.length() + 1;
+    e.rec_len = be.rec.length();
+    e.mtime_sec = be.st.st_mtim.tv_sec;
+    e.mtime_nsec = be.st.st_mtim.tv_nsec;
+    e.size = be.st.st_size;
+    index.push_back(e);
+    ret = (_write_all(f, be.path.c_str(), be.path.length() + 1)
+           && _write_all(f, be.rec.data(), be.rec.length()));
+    off = e.rec_off + e.rec_len;
+  }
+
+  // align the index
+  static const char pad[sizeof(uint64_t)] = { 0 };
+  size_t npad = (sizeof(uint64_t) - (off % sizeof(uint64_t)))
+                % sizeof(uint64_t);
+  ret = (ret && _write_all(f, pad, npad));
+  hdr.index_off = off + npad;
+  if (ret && index.size() > 0) {
+    ret = _write_all(f, &(index[0]), index.size() * sizeof(DbEntry));
+  }
+  ret = (ret && fseek(f, 0, SEEK_SET) == 0
+         && _write_all(f, &hdr, sizeof(hdr)));
+  ret = (ret && fflush(f) == 0 && fsync(fileno(f)) == 0);
+  ret = (fclose(f) == 0 && ret);
+  if (ret) {
+    ret = (chmod(tmp_file.c_str(), 0644) == 0
+           && rename(tmp_file.c_str(), db_file.c_str()) == 0);
+  }
+  if (!ret) {
+    unlink(tmp_file.c_str());
+  }
+  return ret;
+}
+
+} // end namespace unionfs
+} // end namespace cstore
+
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2011 Vyatta, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TMPL_DB_HPP_
+#define _TMPL_DB_HPP_
+#include <string>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cli_cstore.h>
+
+namespace cstore { // begin namespace cstore
+namespace unionfs { // begin namespace unionfs
+
+/* compiled template database.
+ *
+ * the database is a single file containing the parsed form of every
+ * "node.def" under a template root, so that a process can look up a
+ * template without running the node.def parser. the file is mapped
+ * privately (copy-on-write) and strings in the returned vtw_def point
+ * directly into the mapping, so only the vtw_node structures need to be
+ * allocated on lookup.
+ *
+ * each entry records the mtime and size of the node.def it was compiled
+ * from. if these no longer match, the entry is ignored and the caller
+ * falls back to parse_def(). templates not in the database are handled
+ * the same way, so a stale database is never used.
+ */
+class TmplDb {
+public:
+  TmplDb() : _map(0), _map_len(0), _num_entries(0), _entries(0),
+             _init(false) {};
+  ~TmplDb();
+
+  /* open the database file "db_file". returns false if the file does not
+   * exist or is not a valid database, in which case lookup() always
+   * fails.
+   */
+  bool open(const std::string& db_file);
+  bool initialized() const { return _init; };
+
+  /* return an allocated vtw_def for the template "def_file" (full path of
+   * the node.def) with stat info "st", or 0 if not found or stale.
+   */
+  vtw_def *lookup(const char *def_file, const struct stat& st);
+
+  /* compile all templates under "tmpl_root" into "db_file". the file is
+   * replaced atomically.
+   */
+  static bool build(const std::string& tmpl_root, const std::string& db_file);
+
+  static const uint32_t C_DB_VERSION = 1;
+
+private:
+  struct DbHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t index_off;
+  };
+  struct DbEntry {
+    uint64_t path_off;
+    uint64_t rec_off;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t rec_len;
+    uint32_t path_len;
+  };
+  static const char C_DB_MAGIC[8];
+
+  char *_map;
+  size_t _map_len;
+  uint32_t _num_entries;
+  const DbEntry *_entries;
+  bool _init;
+
+  // not copyable
+  TmplDb(const TmplDb&);
+  TmplDb& operator=(const TmplDb&);
+
+  const DbEntry *find_entry(const char *def_file);
+};
+
+} // end namespace unionfs
+} // end namespace cstore
+
+#endif /* _TMPL_DB_HPP_ */
+